@@ -0,0 +1,218 @@
+#ifndef LAZYDEEP1_MAPPEDVARIABLE_HPP
+#define LAZYDEEP1_MAPPEDVARIABLE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Variable.hpp"
+
+namespace lazy {
+
+    // expected access pattern of a mapped table, forwarded to madvise()
+    enum class page_access {
+        normal,
+        sequential,
+        random,
+        will_need,
+        dont_need
+    };
+
+    /*
+     * MappedVariable : matrix variable kept in a memory-mapped file
+     *
+     * The file holds the rows x cols scalars in column-major order, without a header, so a table
+     * may be larger than memory : pages are read by the kernel when a column is touched.
+     * The table is read and updated only through columns (Variable::readColumns / updateColumns),
+     * i.e. by nn::embedding and by the column path of the optimizers; eval() would need the whole
+     * table in memory and throws, as does a dense update (every consumer must be an embedding).
+     * Columns written since the last sync() are tracked by page, and sync() writes back only those.
+     * Optimizer state (Variable::makeSlot) goes to zero-filled files next to the table.
+     *
+     * Errors (cannot open/map, size mismatch, failed msync) throw std::runtime_error.
+     */
+
+    template<typename S>
+    class MappedVariable : public Variable<Matrix<S>> {
+    public:
+        using T = Matrix<S>;
+        using typename Variable<T>::Column;
+        using typename Variable<T>::ColumnFunction;
+
+        // opens path as a rows x cols table, or creates it zero-filled if it is missing or truncate is set
+        MappedVariable(std::string path, Index rows, Index cols, bool truncate = false)
+        : Variable<T>(), m_path(std::move(path)), m_rows(rows), m_cols(cols),
+        m_length(static_cast<std::size_t>(rows * cols) * sizeof(S)),
+        m_page(static_cast<std::size_t>(::sysconf(_SC_PAGESIZE))) {
+            if(rows <= 0 || cols <= 0)
+                throw std::runtime_error("lazy: mapped table of no element");
+
+            const int fd = ::open(m_path.c_str(), O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+            if(fd < 0)
+                throw std::runtime_error("lazy: cannot open " + m_path);
+
+            // a new file is extended without writing : its pages read as zeros
+            struct stat st{};
+            bool ok = ::fstat(fd, &st) == 0;
+            if(ok && st.st_size == 0) ok = ::ftruncate(fd, static_cast<off_t>(m_length)) == 0;
+            else if(ok && static_cast<std::size_t>(st.st_size) != m_length){
+                ::close(fd);
+                throw std::runtime_error("lazy: " + m_path + " does not hold a " + std::to_string(rows)
+                        + " x " + std::to_string(cols) + " table");
+            }
+
+            void* addr = ok ? ::mmap(nullptr, m_length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+            ::close(fd);
+            if(addr == MAP_FAILED)
+                throw std::runtime_error("lazy: cannot map " + m_path);
+            m_map = static_cast<S*>(addr);
+
+            m_dirty.assign((pages() + 63) / 64, 0);
+            // lookups hit columns at random : no read-ahead by default
+            advise(page_access::random);
+        }
+
+        // Anything about Copy/Move is inhibited
+        LAZY_DELETED_FUNCTIONS(MappedVariable, S);
+
+        ~MappedVariable() override {
+            try {
+                sync();
+            } catch(...) {
+                // the kernel still writes the pages back eventually
+            }
+            ::munmap(m_map, m_length);
+        }
+
+        const T& eval() override {
+            throw std::runtime_error("lazy: " + m_path + " is a mapped table, read by columns only");
+        }
+
+        /*
+         * Columns
+         */
+
+        Index rows() override {
+            return m_rows;
+        }
+        Index cols() override {
+            return m_cols;
+        }
+
+        void readColumns(const std::vector<Index>& columns, T& out) override {
+            out.resize(m_rows, static_cast<Index>(columns.size()));
+            for(std::size_t k = 0; k < columns.size(); ++k)
+                out.col(static_cast<Index>(k)) = column(columns[k]);
+        }
+
+        void updateColumns(const std::vector<Index>& columns, const ColumnFunction& f) override {
+            for(std::size_t k = 0; k < columns.size(); ++k){
+                f(k, column(columns[k]));
+                markDirty(columns[k]);
+            }
+            this->resetPost();
+        }
+
+        std::shared_ptr<Variable<T>> makeSlot() override {
+            return std::make_shared<MappedVariable<S>>(m_path + ".slot" + std::to_string(m_slots++), m_rows, m_cols, true);
+        }
+
+        /*
+         * Pages
+         */
+
+        // pages written since the last sync()
+        std::size_t dirtyPages() const noexcept {
+            std::size_t n = 0;
+            for(std::uint64_t word: m_dirty) n += static_cast<std::size_t>(__builtin_popcountll(word));
+            return n;
+        }
+
+        // writes the dirty pages back to the file (waits for the writes unless wait is false)
+        void sync(bool wait = true){
+            const std::size_t total = pages();
+            for(std::size_t p = 0; p < total;){
+                if(!isDirty(p)){
+                    ++p;
+                    continue;
+                }
+                std::size_t end = p;
+                while(end < total && isDirty(end)) ++end;
+
+                const std::size_t length = std::min(end * m_page, m_length) - p * m_page;
+                if(::msync(reinterpret_cast<std::uint8_t*>(m_map) + p * m_page, length, wait ? MS_SYNC : MS_ASYNC) != 0)
+                    throw std::runtime_error("lazy: cannot sync " + m_path);
+                for(; p < end; ++p) m_dirty[p / 64] &= ~(std::uint64_t(1) << (p % 64));
+            }
+        }
+
+        // hint the access pattern of columns [first, first + n) (the whole table by default)
+        void advise(page_access pattern, Index first = 0, Index n = -1){
+            if(n < 0) n = m_cols - first;
+            if(first < 0 || n < 0 || first + n > m_cols)
+                throw std::runtime_error("lazy: mapped columns out of range");
+
+            auto begin = static_cast<std::size_t>(first * m_rows) * sizeof(S);
+            const auto end = static_cast<std::size_t>((first + n) * m_rows) * sizeof(S);
+            begin -= begin % m_page;
+
+            int advice = MADV_NORMAL;
+            switch(pattern){
+                case page_access::normal: advice = MADV_NORMAL; break;
+                case page_access::sequential: advice = MADV_SEQUENTIAL; break;
+                case page_access::random: advice = MADV_RANDOM; break;
+                case page_access::will_need: advice = MADV_WILLNEED; break;
+                case page_access::dont_need: advice = MADV_DONTNEED; break;
+            }
+            ::madvise(reinterpret_cast<std::uint8_t*>(m_map) + begin, end - begin, advice);
+        }
+
+        // writes back and drops every resident page : memory is given back, columns are read again when touched
+        void evict(){
+            sync();
+            advise(page_access::dont_need);
+        }
+
+    private:
+        std::string m_path;
+        Index m_rows, m_cols;
+        std::size_t m_length;
+        std::size_t m_page;
+        S* m_map = nullptr;
+
+        std::vector<std::uint64_t> m_dirty;    // a bit per page
+        Index m_slots = 0;
+
+        std::size_t pages() const noexcept {
+            return (m_length + m_page - 1) / m_page;
+        }
+
+        bool isDirty(std::size_t p) const noexcept {
+            return (m_dirty[p / 64] >> (p % 64)) & 1u;
+        }
+
+        Column column(Index c){
+            if(c < 0 || c >= m_cols)
+                throw std::runtime_error("lazy: mapped column out of range");
+            return Column(m_map + c * m_rows, m_rows);
+        }
+
+        void markDirty(Index c) noexcept {
+            const auto begin = static_cast<std::size_t>(c * m_rows) * sizeof(S);
+            const auto end = begin + static_cast<std::size_t>(m_rows) * sizeof(S);
+            for(std::size_t p = begin / m_page; p * m_page < end; ++p)
+                m_dirty[p / 64] |= std::uint64_t(1) << (p % 64);
+        }
+    };
+
+    template<typename S>
+    decltype(auto) make_mapped_variable(const std::string& path, Index rows, Index cols, bool truncate = false){
+        return std::make_shared<MappedVariable<S>>(path, rows, cols, truncate);
+    }
+}
+
+#endif //LAZYDEEP1_MAPPEDVARIABLE_HPP
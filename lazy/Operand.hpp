@@ -13,6 +13,7 @@
 #include <optional>
 #include <set>
 #include <map>
+#include <vector>
 
 #define LAZY_DELETED_FUNCTIONS(Base, T) \
     Base(const Base<T>&) = delete; \
@@ -26,6 +27,57 @@ namespace lazy {
 
     using Index = Eigen::Index;
 
+    /*
+     * value_traits : what the graph needs to know about a value type beyond its arithmetic
+     * The primary template covers Eigen matrices; other value types (lazy::Tensor) specialize it.
+     */
+
+    template<typename T>
+    struct value_traits {
+        using Shape = std::pair<Index, Index>;
+
+        static Shape shape(const T& v){
+            return {v.rows(), v.cols()};
+        }
+        static void resize(T& v, const Shape& shape){
+            v.resize(shape.first, shape.second);
+        }
+        static T zeros(const Shape& shape){
+            return T::Zero(shape.first, shape.second);
+        }
+        static T zeros_like(const T& v){
+            return T::Zero(v.rows(), v.cols());
+        }
+        static T ones_like(const T& v){
+            return T::Ones(v.rows(), v.cols());
+        }
+        static T constant_like(const T& v, typename T::Scalar value){
+            return T::Constant(v.rows(), v.cols(), value);
+        }
+        // 1x1 value (reductions to a scalar)
+        static T scalar(typename T::Scalar value){
+            return T::Constant(1, 1, value);
+        }
+        // packed elements from data() (matrices always are)
+        static const T& contiguous(const T& v){
+            return v;
+        }
+        // deltas may be kept as a few columns (see ColumnDelta)
+        static constexpr bool column_deltas = true;
+    };
+
+    /*
+     * ColumnDelta : a delta that is zero outside a few columns (e.g. of an embedding table)
+     * values.col(k) is the delta of column columns[k]. A column may be listed more than once;
+     * its deltas then add up.
+     */
+
+    template<typename T>
+    struct ColumnDelta {
+        std::vector<Index> columns;
+        T values;
+    };
+
     template<typename T>
     class Operand {
     public:
@@ -34,6 +86,10 @@ namespace lazy {
         using Function = std::function<T()>;
         using DFunction = std::function<T(const Pointer&)>;
         using PointerMap = std::map<Pointer, DFunction>;
+        using DScatterFunction = std::function<void(const Pointer&, T&, bool)>;
+        using PointerScatterMap = std::map<Pointer, DScatterFunction>;
+        using DColumnFunction = std::function<void(const Pointer&, ColumnDelta<T>&)>;
+        using PointerColumnMap = std::map<Pointer, DColumnFunction>;
         using PointerSet = std::set<Pointer>;
 
         /*
@@ -41,10 +97,10 @@ namespace lazy {
          */
 
         explicit Operand()
-        : m_f([](){return T();}), m_df(),
-        m_pre(), m_post(),
+        : m_f([](){return T();}), m_df(), m_scatter(), m_columns(),
+        m_pre(), m_post(), m_value_free(),
         m_value(std::nullopt), m_delta(),
-        m_optimizable(false) {
+        m_optimizable(false), m_value_retained(false), m_released(false) {
 
         }
 
@@ -58,7 +114,15 @@ namespace lazy {
          */
 
         virtual const T& eval(){
-            return m_value.has_value() ? m_value.value() : m_value.emplace(m_f());
+            if(m_value.has_value() && !m_released){
+                return m_value.value();
+            }
+
+            m_value.emplace(m_f());
+            m_released = false;
+            for(const auto& ptr: m_pre) ptr->releaseDeadValue();
+
+            return m_value.value();
         }
 
         virtual const T& diff(const Pointer& E){
@@ -67,24 +131,55 @@ namespace lazy {
             }
 
             auto& cache = m_delta[E];
-            const T& val = eval();
-            cache = T::Zero(val.rows(), val.cols());
 
             if(m_post.empty()){
+                const T& val = eval();
                 if(E.get() == this){
-                    cache = T::Ones(val.rows(), val.cols());
+                    cache = value_traits<T>::ones_like(val);
+                } else {
+                    cache = value_traits<T>::zeros_like(val);
                 }
 
                 return cache;
             }
 
+            // the first delta initializes the cache, so the value is not needed for its shape
+            bool empty = true;
             for(const auto& [ptr, df]: m_df){
-                cache = cache + df(E);
+                if(empty){
+                    cache = df(E);
+                    empty = false;
+                } else {
+                    cache += df(E);
+                }
+            }
+            for(const auto& [ptr, scatter]: m_scatter){
+                scatter(E, cache, !empty);
+                empty = false;
+            }
+
+            if(empty){
+                cache = value_traits<T>::zeros_like(eval());
             }
 
             return cache;
         }
 
+        // delta as a few columns (not cached) : false unless every post operand gives a column delta
+        bool diffColumns(const Pointer& E, ColumnDelta<T>& out){
+            if(m_post.empty() || !m_df.empty()) return false;
+            for(const auto& ptr: m_post){
+                if(m_columns.find(ptr) == m_columns.end()) return false;
+            }
+
+            out.columns.clear();
+            out.values = T();
+            for(const auto& [ptr, column]: m_columns){
+                column(E, out);
+            }
+            return true;
+        }
+
         /*
          * Getter/Setter
          */
@@ -108,6 +203,35 @@ namespace lazy {
             return m_df;
         }
 
+        /*
+         * Scatter deltas
+         * A post operand that reads only a block of this value (e.g. slice) may register
+         * scatter(E, cache, initialized) instead of a delta function : it adds its delta into
+         * its block of the cache, and sizes the cache first when initialized is false.
+         * Delta functions run first, so the cache is zero-filled only when every post operand scatters.
+         */
+
+        PointerScatterMap& getScatterDF() noexcept {
+            return m_scatter;
+        }
+        const PointerScatterMap& getScatterDF() const noexcept {
+            return m_scatter;
+        }
+
+        /*
+         * Column deltas
+         * A post operand that reads only a few columns of this value (e.g. embedding) may register
+         * column(E, out) next to its scatter delta : it appends its columns to out (see diffColumns).
+         * The scatter delta still serves diff(), which is dense.
+         */
+
+        PointerColumnMap& getColumnDF() noexcept {
+            return m_columns;
+        }
+        const PointerColumnMap& getColumnDF() const noexcept {
+            return m_columns;
+        }
+
         virtual void setFunction(Function f){
             m_f = std::move(f);
         }
@@ -116,6 +240,26 @@ namespace lazy {
             return m_optimizable;
         }
 
+        /*
+         * Value lifetime
+         * By default every evaluated value is kept until resetValue(),
+         * since the deltas of post operands may read it.
+         * When all post operands have been detached (their deltas do not read this value)
+         * and this operand's own delta does not read it either,
+         * the value is released as soon as every post operand has been evaluated.
+         * A released value is recomputed if it is evaluated again.
+         */
+
+        // post operand ptr computes its delta without this value
+        void detachValue(const Pointer& ptr){
+            m_value_free.insert(ptr);
+        }
+
+        // the delta of this operand reads its own value
+        void retainValue() noexcept {
+            m_value_retained = true;
+        }
+
         /*
          * Re-setter
          */
@@ -123,6 +267,7 @@ namespace lazy {
         virtual void resetValue(){
             if(m_value.has_value()){
                 m_value.reset();
+                m_released = false;
                 if(m_post.empty()){
                     resetDelta();
                 } else {
@@ -141,19 +286,70 @@ namespace lazy {
     protected:
         Function m_f;
         PointerMap m_df;
+        PointerScatterMap m_scatter;
+        PointerColumnMap m_columns;
         PointerSet m_pre;
         PointerSet m_post;
+        PointerSet m_value_free;
 
         std::optional<T> m_value;
         std::map<Pointer, T> m_delta;
 
         bool m_optimizable;
+        bool m_value_retained;
+        bool m_released;
+
+        void releaseDeadValue(){
+            if(m_released || m_value_retained || m_pre.empty() || m_post.empty() || !m_value.has_value()){
+                return;
+            }
+
+            for(const auto& ptr: m_post){
+                if(m_value_free.find(ptr) == m_value_free.end() || !ptr->m_value.has_value()){
+                    return;
+                }
+            }
+
+            m_value.emplace();
+            m_released = true;
+        }
     };
 
     template<typename T, typename ...Types>
     decltype(auto) make_operand(Types ...args){
         return std::make_shared<Operand<T>>(args...);
     }
+
+    /*
+     * OperandLink : post operand of an Operand<From> standing for an Operand<To>
+     * Operators whose inputs have another value type (e.g. raw uint8 inputs of a float graph)
+     * cannot be post operands of them, so the link forwards resetValue() to the operator instead.
+     */
+
+    template<typename From, typename To>
+    class OperandLink : public Operand<From> {
+    public:
+        explicit OperandLink(typename Operand<To>::Pointer target)
+        : Operand<From>(), m_target(std::move(target)) {
+
+        }
+
+        void resetValue() override {
+            m_target->resetValue();
+        }
+
+        void resetDelta() override {
+            // nothing flows back to the From operand
+        }
+
+    private:
+        typename Operand<To>::Pointer m_target;
+    };
+
+    template<typename From, typename To>
+    void link_operand(const std::shared_ptr<Operand<From>>& from, const std::shared_ptr<Operand<To>>& to){
+        from->getPostOperand().insert(std::make_shared<OperandLink<From, To>>(to));
+    }
 }
 
 #endif //LAZYDEEP1_OPERAND_HPP
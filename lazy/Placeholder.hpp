@@ -11,24 +11,82 @@ namespace lazy {
     template<typename T>
     class Placeholder : public Operand<T> {
     public:
-        explicit Placeholder(): Operand<T>(){
+        explicit Placeholder(): Operand<T>(), m_bound(nullptr){
 
         }
 
         // Anything about Copy/Move is inhibited
         LAZY_DELETED_FUNCTIONS(Placeholder, T);
 
+        const T& eval() override {
+            return m_bound ? *m_bound : Operand<T>::eval();
+        }
+
         const T& diff(const typename Operand<T>::Pointer& E) override {
-            const T& val = this->eval();
-            return this->m_delta[E] = T::Zero(val.rows(), val.cols());
+            return this->m_delta[E] = value_traits<T>::zeros_like(this->eval());
+        }
+
+        /*
+         * Feeding
+         * feed(T&&)      : takes the matrix over (no copy)
+         * feed(const T&) : copies the matrix
+         * bind(const T&) : uses the caller's matrix in place until the next feed/bind;
+         *                  it must outlive the evaluations, and refresh() must be called
+         *                  after it is overwritten in place
+         */
+
+        void feed(T&& value){
+            resetValue();
+            this->m_value.emplace(std::move(value));
+        }
+
+        void feed(const T& value){
+            resetValue();
+            this->m_value.emplace(value);
+        }
+
+        void bind(const T& value){
+            resetValue();
+            m_bound = &value;
+        }
+
+        void refresh(){
+            const T* bound = m_bound;
+            resetValue();
+            m_bound = bound;
+        }
+
+        bool isBound() const noexcept {
+            return m_bound != nullptr;
+        }
+
+        void resetValue() override {
+            if(m_bound){
+                // nothing is stored, but everything computed from the bound matrix is stale
+                m_bound = nullptr;
+                if(this->m_post.empty()){
+                    this->resetDelta();
+                } else {
+                    for(const auto& ptr: this->m_post) ptr->resetValue();
+                }
+            }
+            Operand<T>::resetValue();
         }
 
         static void applyPlaceholders(const std::map<std::shared_ptr<Placeholder<T>>, T>& mp){
             for(const auto& [ptr, value] : mp){
-                ptr->resetValue();
-                ptr->m_value.emplace(value);
+                ptr->feed(value);
             }
         }
+
+        static void applyPlaceholders(std::map<std::shared_ptr<Placeholder<T>>, T>&& mp){
+            for(auto& [ptr, value] : mp){
+                ptr->feed(std::move(value));
+            }
+        }
+
+    private:
+        const T* m_bound;
     };
 
     template<typename T>
@@ -0,0 +1,84 @@
+#ifndef LAZYDEEP1_SPARSE_HPP
+#define LAZYDEEP1_SPARSE_HPP
+
+#include <type_traits>
+#include "Operand.hpp"
+
+namespace lazy {
+
+    /*
+     * Sparse inputs (bag of words, hashed features)
+     * SparseMatrix<S> is Eigen's compressed column-major matrix; as every input it is
+     * features x samples, so a column is a sample and the matrix is the CSR layout of the
+     * samples x features batch. It is a value of Placeholders only : operators take it as an
+     * input of another value type (like raw integer inputs) and give it no delta.
+     */
+
+    template<typename S>
+    using SparseMatrix = Eigen::SparseMatrix<S, Eigen::ColMajor, int>;
+
+    template<typename T>
+    struct is_sparse : std::false_type {};
+
+    template<typename S, int Options, typename I>
+    struct is_sparse<Eigen::SparseMatrix<S, Options, I>> : std::true_type {};
+
+    template<typename T>
+    inline constexpr bool is_sparse_v = is_sparse<T>::value;
+
+    template<typename S, int Options, typename I>
+    struct value_traits<Eigen::SparseMatrix<S, Options, I>> {
+        using T = Eigen::SparseMatrix<S, Options, I>;
+        using Shape = std::pair<Index, Index>;
+
+        static Shape shape(const T& v){
+            return {v.rows(), v.cols()};
+        }
+        static void resize(T& v, const Shape& shape){
+            v.resize(shape.first, shape.second);
+        }
+        static T zeros(const Shape& shape){
+            return T(shape.first, shape.second);
+        }
+        static T zeros_like(const T& v){
+            return T(v.rows(), v.cols());
+        }
+        static T ones_like(const T& v){
+            return constant_like(v, S(1));
+        }
+        static T constant_like(const T& v, S value){
+            return Matrix<S>::Constant(v.rows(), v.cols(), value).sparseView();
+        }
+        static T scalar(S value){
+            return constant_like(T(1, 1), value);
+        }
+        static const T& contiguous(const T& v){
+            return v;
+        }
+        static constexpr bool column_deltas = false;
+    };
+
+    /*
+     * A CSR batch of n samples : the features (increasing) and values of sample j are at
+     * [offsets[j], offsets[j + 1]) of indices / values, as scipy and libsvm readers give them.
+     * The arrays are copied as they are into the features x n input; nothing is densified.
+     */
+
+    template<typename S, typename I>
+    SparseMatrix<S> from_csr(Index features, Index n, const I* offsets, const I* indices, const S* values){
+        // (offsets may start past 0 : n samples out of a larger batch)
+        const auto first = static_cast<Index>(offsets[0]);
+        const auto nnz = static_cast<Index>(offsets[n]) - first;
+
+        SparseMatrix<S> ret(features, n);
+        ret.resizeNonZeros(nnz);
+        for(Index j = 0; j <= n; ++j) ret.outerIndexPtr()[j] = static_cast<int>(static_cast<Index>(offsets[j]) - first);
+        for(Index k = 0; k < nnz; ++k){
+            ret.innerIndexPtr()[k] = static_cast<int>(indices[first + k]);
+            ret.valuePtr()[k] = values[first + k];
+        }
+        return ret;
+    }
+}
+
+#endif //LAZYDEEP1_SPARSE_HPP
@@ -0,0 +1,673 @@
+#ifndef LAZYDEEP1_TENSOR_HPP
+#define LAZYDEEP1_TENSOR_HPP
+
+#include <array>
+#include <initializer_list>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "Operand.hpp"
+
+namespace lazy {
+
+    /*
+     * TensorShape : extents (or strides) of up to MaxRank axes, kept inline
+     * so that views never allocate. The empty shape is a scalar (one element).
+     */
+
+    class TensorShape {
+    public:
+        static constexpr std::size_t MaxRank = 8;
+
+        TensorShape() = default;
+
+        TensorShape(std::initializer_list<Index> dims){
+            if(dims.size() > MaxRank)
+                throw std::runtime_error("lazy: tensor rank is limited to 8");
+            for(Index d: dims) m_dims[m_rank++] = d;
+        }
+
+        TensorShape(std::size_t rank, Index fill){
+            resize(rank, fill);
+        }
+
+        void resize(std::size_t rank, Index fill = 1){
+            if(rank > MaxRank)
+                throw std::runtime_error("lazy: tensor rank is limited to 8");
+            for(std::size_t a = m_rank; a < rank; ++a) m_dims[a] = fill;
+            m_rank = rank;
+        }
+
+        std::size_t rank() const noexcept {
+            return m_rank;
+        }
+
+        // number of elements
+        Index count() const noexcept {
+            Index n = 1;
+            for(std::size_t a = 0; a < m_rank; ++a) n *= m_dims[a];
+            return n;
+        }
+
+        Index& operator[](std::size_t a) noexcept {
+            return m_dims[a];
+        }
+        Index operator[](std::size_t a) const noexcept {
+            return m_dims[a];
+        }
+
+        // extent of axis a, 1 past the last axis
+        Index dim(std::size_t a) const noexcept {
+            return a < m_rank ? m_dims[a] : 1;
+        }
+
+        const Index* begin() const noexcept {
+            return m_dims.data();
+        }
+        const Index* end() const noexcept {
+            return m_dims.data() + m_rank;
+        }
+
+        bool operator==(const TensorShape& rhs) const noexcept {
+            return m_rank == rhs.m_rank && std::equal(begin(), end(), rhs.begin());
+        }
+        bool operator!=(const TensorShape& rhs) const noexcept {
+            return !(*this == rhs);
+        }
+
+    private:
+        std::array<Index, MaxRank> m_dims{};
+        std::size_t m_rank = 0;
+    };
+
+    namespace detail {
+
+        // column-major strides of a packed tensor
+        inline TensorShape packed_strides(const TensorShape& shape){
+            TensorShape strides(shape.rank(), 0);
+            Index s = 1;
+            for(std::size_t a = 0; a < shape.rank(); ++a){
+                strides[a] = s;
+                s *= shape[a];
+            }
+            return strides;
+        }
+
+        // shapes are aligned on the first axis; an axis of extent 1 (or missing) stretches
+        inline TensorShape broadcast_shape(const TensorShape& a, const TensorShape& b){
+            TensorShape out(std::max(a.rank(), b.rank()), 1);
+            for(std::size_t i = 0; i < out.rank(); ++i){
+                const Index x = a.dim(i), y = b.dim(i);
+                if(x != y && x != 1 && y != 1)
+                    throw std::runtime_error("lazy: tensor shapes cannot be broadcast together");
+                out[i] = x == 1 ? y : x;
+            }
+            return out;
+        }
+
+        /*
+         * for_each_run : visits every element of shape in column-major order, one run along axis 0 at a time
+         * f(run, offsets, steps) : offsets[k] is the first element of the run in operand k,
+         *                          steps[k] the distance between its consecutive elements
+         */
+
+        template<std::size_t N, typename F>
+        void for_each_run(const TensorShape& shape, const std::array<const TensorShape*, N>& strides,
+                std::array<Index, N> offsets, F&& f){
+            const std::size_t rank = shape.rank();
+            const Index total = shape.count();
+            if(total == 0) return;
+
+            std::array<Index, N> steps{};
+            if(rank > 0){
+                for(std::size_t k = 0; k < N; ++k) steps[k] = (*strides[k])[0];
+            }
+            const Index run = rank > 0 ? shape[0] : 1;
+
+            TensorShape counter(rank, 0);
+            for(Index done = 0; done < total; done += run){
+                f(run, offsets, steps);
+                for(std::size_t a = 1; a < rank; ++a){
+                    for(std::size_t k = 0; k < N; ++k) offsets[k] += (*strides[k])[a];
+                    if(++counter[a] < shape[a]) break;
+                    for(std::size_t k = 0; k < N; ++k) offsets[k] -= (*strides[k])[a] * shape[a];
+                    counter[a] = 0;
+                }
+            }
+        }
+    }
+
+    /*
+     * Tensor : N-dimensional strided value, usable as the value type of an Operand
+     *
+     * Elements are column-major like Eigen's (axis 0 varies fastest), so a packed
+     * rank-2 tensor has the memory of the Matrix of the same shape, and the leading
+     * axes of {rows, cols, batch...} are one contiguous matrix per batch index.
+     *
+     * Copies share the storage, and reshape / transpose / permute / slice / broadcast
+     * only rewrite the shape, the strides and the offset (broadcast axes have stride 0).
+     * Writing through a non-const accessor (data(), operator(), +=, ...) first gives the
+     * tensor storage of its own when it is shared or not packed, so a tensor behaves
+     * like a value: a write never shows through another tensor or view.
+     * Read through a const reference to avoid that copy.
+     *
+     *   Tensor<float> x = Tensor<float>::Zero({28, 28, 100});
+     *   auto rows = x.reshape({784, 100});        // same storage
+     *   auto bias = b.broadcast(rows.shape());    // b : {784}, no copy
+     */
+
+    template<typename S>
+    class Tensor {
+    public:
+        using Scalar = S;
+        using Storage = Matrix<S>;
+        using Flat = Eigen::Map<Eigen::Matrix<S, Eigen::Dynamic, 1>>;
+        using ConstFlat = Eigen::Map<const Eigen::Matrix<S, Eigen::Dynamic, 1>>;
+        using MatrixMap = Eigen::Map<const Matrix<S>, Eigen::Unaligned, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>>;
+
+        Tensor()
+        : m_storage(), m_offset(0), m_shape{0}, m_strides{1} {
+
+        }
+
+        // uninitialized, packed
+        explicit Tensor(const TensorShape& shape)
+        : m_storage(std::make_shared<Storage>(shape.count(), 1)), m_offset(0),
+        m_shape(shape), m_strides(detail::packed_strides(shape)) {
+
+        }
+
+        // takes the matrix over as a {rows, cols} tensor (no copy when moved in)
+        static Tensor fromMatrix(Storage m){
+            Tensor ret;
+            ret.m_shape = {m.rows(), m.cols()};
+            ret.m_strides = {1, m.rows()};
+            ret.m_storage = std::make_shared<Storage>(std::move(m));
+            return ret;
+        }
+
+        static Tensor Constant(const TensorShape& shape, S value){
+            Tensor ret(shape);
+            ret.flat().setConstant(value);
+            return ret;
+        }
+
+        static Tensor Zero(const TensorShape& shape){
+            return Constant(shape, S(0));
+        }
+
+        static Tensor Ones(const TensorShape& shape){
+            return Constant(shape, S(1));
+        }
+
+        /*
+         * Shape
+         */
+
+        const TensorShape& shape() const noexcept {
+            return m_shape;
+        }
+
+        const TensorShape& strides() const noexcept {
+            return m_strides;
+        }
+
+        std::size_t rank() const noexcept {
+            return m_shape.rank();
+        }
+
+        Index dim(std::size_t axis) const noexcept {
+            return m_shape.dim(axis);
+        }
+
+        Index size() const noexcept {
+            return m_shape.count();
+        }
+
+        // elements are packed in column-major order from data()
+        bool isContiguous() const noexcept {
+            Index expected = 1;
+            for(std::size_t a = 0; a < rank(); ++a){
+                if(m_shape[a] != 1 && m_strides[a] != expected) return false;
+                expected *= m_shape[a];
+            }
+            return true;
+        }
+
+        // contents are unspecified afterwards, like Eigen's resize
+        void resize(const TensorShape& shape){
+            if(!(m_storage && m_storage.use_count() == 1 && m_offset == 0
+                    && m_storage->size() == shape.count())){
+                m_storage = std::make_shared<Storage>(shape.count(), 1);
+                m_offset = 0;
+            }
+            m_shape = shape;
+            m_strides = detail::packed_strides(shape);
+        }
+
+        /*
+         * Views (metadata only)
+         */
+
+        // one axis may be -1 (inferred); copies only if the elements are not packed
+        Tensor reshape(TensorShape shape) const {
+            Index known = 1, inferred = -1;
+            for(std::size_t a = 0; a < shape.rank(); ++a){
+                if(shape[a] == -1){
+                    if(inferred >= 0) throw std::runtime_error("lazy: reshape can infer one axis only");
+                    inferred = static_cast<Index>(a);
+                } else {
+                    known *= shape[a];
+                }
+            }
+            if(inferred >= 0 && known > 0) shape[inferred] = size() / known;
+            if(shape.count() != size())
+                throw std::runtime_error("lazy: reshape does not keep the number of elements");
+
+            Tensor ret = isContiguous() ? *this : contiguous();
+            ret.m_shape = shape;
+            ret.m_strides = detail::packed_strides(shape);
+            return ret;
+        }
+
+        // axis i of the result is axis axes[i] of this tensor
+        Tensor permute(const TensorShape& axes) const {
+            if(axes.rank() != rank())
+                throw std::runtime_error("lazy: permute needs one entry per axis");
+            Tensor ret = *this;
+            std::array<bool, TensorShape::MaxRank> seen{};
+            for(std::size_t a = 0; a < rank(); ++a){
+                const auto from = static_cast<std::size_t>(axes[a]);
+                if(axes[a] < 0 || from >= rank() || seen[from])
+                    throw std::runtime_error("lazy: permute needs a permutation of the axes");
+                seen[from] = true;
+                ret.m_shape[a] = m_shape[from];
+                ret.m_strides[a] = m_strides[from];
+            }
+            return ret;
+        }
+
+        Tensor transpose(std::size_t a, std::size_t b) const {
+            if(a >= rank() || b >= rank())
+                throw std::runtime_error("lazy: transpose axis out of range");
+            Tensor ret = *this;
+            std::swap(ret.m_shape[a], ret.m_shape[b]);
+            std::swap(ret.m_strides[a], ret.m_strides[b]);
+            return ret;
+        }
+
+        // swaps the two leading (matrix) axes; a vector {n} becomes a row {1, n}
+        Tensor transpose() const {
+            if(rank() >= 2) return transpose(0, 1);
+            if(rank() == 0) return *this;
+            Tensor ret = *this;
+            ret.m_shape = {1, m_shape[0]};
+            ret.m_strides = {m_strides[0] * m_shape[0], m_strides[0]};
+            return ret;
+        }
+
+        // elements [begin, begin + length) of axis
+        Tensor slice(std::size_t axis, Index begin, Index length) const {
+            if(axis >= rank() || begin < 0 || length < 0 || begin + length > m_shape[axis])
+                throw std::runtime_error("lazy: slice out of range");
+            Tensor ret = *this;
+            ret.m_offset += begin * m_strides[axis];
+            ret.m_shape[axis] = length;
+            return ret;
+        }
+
+        // stretches axes of extent 1 (and missing trailing axes) to shape with stride 0
+        Tensor broadcast(const TensorShape& shape) const {
+            if(detail::broadcast_shape(m_shape, shape) != shape)
+                throw std::runtime_error("lazy: tensor cannot be broadcast to the shape");
+            Tensor ret = *this;
+            ret.m_shape = shape;
+            ret.m_strides = TensorShape(shape.rank(), 0);
+            for(std::size_t a = 0; a < std::min(rank(), shape.rank()); ++a){
+                if(m_shape[a] == shape[a]) ret.m_strides[a] = m_strides[a];
+            }
+            return ret;
+        }
+
+        // this tensor if it is packed, a packed copy otherwise
+        Tensor contiguous() const {
+            if(isContiguous()) return *this;
+
+            Tensor ret(m_shape);
+            S* dst = ret.m_storage->data();
+            const S* src = m_storage->data();
+            detail::for_each_run<2>(m_shape, {&ret.m_strides, &m_strides}, {0, m_offset},
+                    [dst, src](Index run, const auto& off, const auto& step){
+                S* o = dst + off[0];
+                const S* x = src + off[1];
+                const Index s = step[1];
+                if(s == 1){
+                    for(Index i = 0; i < run; ++i) o[i] = x[i];
+                } else {
+                    for(Index i = 0; i < run; ++i) o[i] = x[i * s];
+                }
+            });
+            return ret;
+        }
+
+        /*
+         * Element access
+         */
+
+        const S* data() const& noexcept {
+            return m_storage ? m_storage->data() + m_offset : nullptr;
+        }
+
+        // packed storage of its own, so it can be written (temporaries are read through the const overloads)
+        S* data() &{
+            detach();
+            return m_storage ? m_storage->data() + m_offset : nullptr;
+        }
+
+        template<typename ...Indices>
+        const S& operator()(Indices ...indices) const& {
+            return m_storage->data()[offsetOf({static_cast<Index>(indices)...})];
+        }
+
+        template<typename ...Indices>
+        S& operator()(Indices ...indices) &{
+            detach();
+            return m_storage->data()[offsetOf({static_cast<Index>(indices)...})];
+        }
+
+        // the only element (like Eigen's value() of a 1x1 matrix)
+        S value() const {
+            if(size() != 1) throw std::runtime_error("lazy: value() of a tensor with more than one element");
+            return m_storage->data()[m_offset];
+        }
+
+        // the elements in order (packed tensors only)
+        ConstFlat flat() const& {
+            if(!isContiguous()) throw std::runtime_error("lazy: flat() of a strided tensor view");
+            return ConstFlat(data(), size());
+        }
+
+        Flat flat() &{
+            return Flat(data(), size());
+        }
+
+        // a rank-2 tensor (or view) as a matrix, strides included
+        MatrixMap matrix() const {
+            if(rank() > 2) throw std::runtime_error("lazy: matrix() of a tensor of rank > 2");
+            return MatrixMap(data(), dim(0), dim(1),
+                    Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(rank() > 1 ? m_strides[1] : dim(0),
+                            rank() > 0 ? m_strides[0] : 1));
+        }
+
+        /*
+         * Element-wise
+         */
+
+        template<typename F>
+        Tensor unaryExpr(const F& f) const {
+            return apply([&f](const auto& x){ return x.unaryExpr(f); });
+        }
+
+        // broadcasts the two operands to a common shape
+        template<typename F>
+        Tensor binaryExpr(const Tensor& rhs, const F& f) const {
+            if(m_shape == rhs.m_shape && isContiguous() && rhs.isContiguous()){
+                Tensor ret(m_shape);
+                ret.flat() = flat().binaryExpr(rhs.flat(), f);
+                return ret;
+            }
+
+            const TensorShape shape = detail::broadcast_shape(m_shape, rhs.m_shape);
+            const Tensor a = broadcast(shape), b = rhs.broadcast(shape);
+            Tensor ret(shape);
+            S* dst = ret.m_storage->data();
+            const S* pa = a.m_storage->data();
+            const S* pb = b.m_storage->data();
+            detail::for_each_run<3>(shape, {&ret.m_strides, &a.m_strides, &b.m_strides}, {0, a.m_offset, b.m_offset},
+                    [&f, dst, pa, pb](Index run, const auto& off, const auto& step){
+                S* o = dst + off[0];
+                const S* x = pa + off[1];
+                const S* y = pb + off[2];
+                for(Index i = 0; i < run; ++i) o[i] = f(x[i * step[1]], y[i * step[2]]);
+            });
+            return ret;
+        }
+
+        Tensor cwiseProduct(const Tensor& rhs) const {
+            return binaryExpr(rhs, Eigen::internal::scalar_product_op<S, S>());
+        }
+
+        Tensor cwiseQuotient(const Tensor& rhs) const {
+            return binaryExpr(rhs, Eigen::internal::scalar_quotient_op<S, S>());
+        }
+
+        Tensor operator+(const Tensor& rhs) const {
+            return binaryExpr(rhs, Eigen::internal::scalar_sum_op<S, S>());
+        }
+
+        Tensor operator-(const Tensor& rhs) const {
+            return binaryExpr(rhs, Eigen::internal::scalar_difference_op<S, S>());
+        }
+
+        Tensor operator-() const {
+            return apply([](const auto& x){ return -x; });
+        }
+
+        Tensor operator*(S s) const {
+            return apply([s](const auto& x){ return x * s; });
+        }
+
+        Tensor operator/(S s) const {
+            return apply([s](const auto& x){ return x / s; });
+        }
+
+        // rhs is broadcast to the shape of this tensor
+        Tensor& operator+=(const Tensor& rhs){
+            return update(rhs, Eigen::internal::scalar_sum_op<S, S>());
+        }
+
+        Tensor& operator-=(const Tensor& rhs){
+            return update(rhs, Eigen::internal::scalar_difference_op<S, S>());
+        }
+
+        // writes rhs (broadcast to the block) into elements [begin, begin + rhs.dim(axis)) of axis
+        Tensor& assignSlice(std::size_t axis, Index begin, const Tensor& rhs){
+            return updateSlice(axis, begin, rhs, [](S, S y){ return y; });
+        }
+
+        Tensor& addSlice(std::size_t axis, Index begin, const Tensor& rhs){
+            return updateSlice(axis, begin, rhs, Eigen::internal::scalar_sum_op<S, S>());
+        }
+
+        Tensor& operator*=(S s){
+            flat() *= s;
+            return *this;
+        }
+
+        template<typename U>
+        Tensor<U> cast() const {
+            Tensor<U> ret(m_shape);
+            ret.flat() = contiguous().flat().template cast<U>();
+            return ret;
+        }
+
+        void setZero(){
+            flat().setZero();
+        }
+
+        void setConstant(S value){
+            flat().setConstant(value);
+        }
+
+        /*
+         * Reductions
+         */
+
+        S sum() const {
+            if(isContiguous()) return flat().sum();
+            S acc(0);
+            const S* src = m_storage->data();
+            detail::for_each_run<1>(m_shape, {&m_strides}, {m_offset},
+                    [&acc, src](Index run, const auto& off, const auto& step){
+                const S* x = src + off[0];
+                for(Index i = 0; i < run; ++i) acc += x[i * step[0]];
+            });
+            return acc;
+        }
+
+        S mean() const {
+            return sum() / static_cast<S>(size());
+        }
+
+        S maxCoeff() const {
+            return contiguous().flat().maxCoeff();
+        }
+
+        S minCoeff() const {
+            return contiguous().flat().minCoeff();
+        }
+
+        // sums over the axes where shape has extent 1, the reverse of broadcast(this->shape())
+        Tensor sumTo(const TensorShape& shape) const {
+            if(shape == m_shape) return contiguous();
+
+            Tensor ret = Zero(shape);
+
+            const Tensor acc = ret.broadcast(m_shape);
+            S* dst = ret.m_storage->data();
+            const S* src = m_storage->data();
+            detail::for_each_run<2>(m_shape, {&acc.m_strides, &m_strides}, {0, m_offset},
+                    [dst, src](Index run, const auto& off, const auto& step){
+                S* o = dst + off[0];
+                const S* x = src + off[1];
+                if(step[0] == 0){
+                    S partial(0);
+                    for(Index i = 0; i < run; ++i) partial += x[i * step[1]];
+                    *o += partial;
+                } else if(step[1] == 1){
+                    for(Index i = 0; i < run; ++i) o[i] += x[i];
+                } else {
+                    for(Index i = 0; i < run; ++i) o[i] += x[i * step[1]];
+                }
+            });
+            return ret;
+        }
+
+    private:
+        template<typename> friend class Tensor;
+
+        std::shared_ptr<Storage> m_storage;
+        Index m_offset;
+        TensorShape m_shape;
+        TensorShape m_strides;
+
+        // storage of its own with the elements packed from m_offset
+        void detach(){
+            if(!m_storage || (m_storage.use_count() == 1 && isContiguous())) return;
+            Tensor packed(m_shape);
+            if(size() > 0) packed.flat() = contiguous().flat();
+            *this = std::move(packed);
+        }
+
+        Index offsetOf(std::initializer_list<Index> indices) const {
+            if(indices.size() != rank())
+                throw std::runtime_error("lazy: wrong number of tensor indices");
+            Index off = m_offset;
+            std::size_t a = 0;
+            for(Index i: indices) off += i * m_strides[a++];
+            return off;
+        }
+
+        template<typename F>
+        Tensor apply(const F& f) const {
+            const Tensor src = contiguous();
+            Tensor ret(m_shape);
+            ret.flat() = f(src.flat());
+            return ret;
+        }
+
+        template<typename F>
+        Tensor& updateSlice(std::size_t axis, Index begin, const Tensor& rhs, const F& f){
+            detach();
+            const Tensor region = std::as_const(*this).slice(axis, begin, rhs.dim(axis));
+            const Tensor b = rhs.broadcast(region.m_shape);
+            S* dst = m_storage->data();
+            const S* src = b.m_storage->data();
+            detail::for_each_run<2>(region.m_shape, {&region.m_strides, &b.m_strides}, {region.m_offset, b.m_offset},
+                    [&f, dst, src](Index run, const auto& off, const auto& step){
+                S* o = dst + off[0];
+                const S* y = src + off[1];
+                for(Index i = 0; i < run; ++i) o[i * step[0]] = f(o[i * step[0]], y[i * step[1]]);
+            });
+            return *this;
+        }
+
+        template<typename F>
+        Tensor& update(const Tensor& rhs, const F& f){
+            if(m_shape == rhs.m_shape && rhs.isContiguous()){
+                // rhs may share the storage; it keeps it while this tensor is detached
+                const Tensor keep = rhs;
+                flat() = ConstFlat(data(), size()).binaryExpr(keep.flat(), f);
+                return *this;
+            }
+
+            const Tensor b = rhs.broadcast(m_shape);
+            S* dst = data();
+            const S* src = b.m_storage->data();
+            detail::for_each_run<2>(m_shape, {&m_strides, &b.m_strides}, {0, b.m_offset},
+                    [&f, dst, src](Index run, const auto& off, const auto& step){
+                S* o = dst + off[0];
+                const S* y = src + off[1];
+                for(Index i = 0; i < run; ++i) o[i] = f(o[i], y[i * step[1]]);
+            });
+            return *this;
+        }
+    };
+
+    template<typename S>
+    Tensor<S> operator*(S s, const Tensor<S>& t){
+        return t * s;
+    }
+
+    template<typename T>
+    struct is_tensor : std::false_type {};
+
+    template<typename S>
+    struct is_tensor<Tensor<S>> : std::true_type {};
+
+    template<typename T>
+    inline constexpr bool is_tensor_v = is_tensor<T>::value;
+
+    template<typename S>
+    struct value_traits<Tensor<S>> {
+        using Shape = TensorShape;
+
+        static Shape shape(const Tensor<S>& v){
+            return v.shape();
+        }
+        static void resize(Tensor<S>& v, const Shape& shape){
+            v.resize(shape);
+        }
+        static Tensor<S> zeros(const Shape& shape){
+            return Tensor<S>::Zero(shape);
+        }
+        static Tensor<S> zeros_like(const Tensor<S>& v){
+            return Tensor<S>::Zero(v.shape());
+        }
+        static Tensor<S> ones_like(const Tensor<S>& v){
+            return Tensor<S>::Ones(v.shape());
+        }
+        static Tensor<S> constant_like(const Tensor<S>& v, S value){
+            return Tensor<S>::Constant(v.shape(), value);
+        }
+        static Tensor<S> scalar(S value){
+            return Tensor<S>::Constant({}, value);
+        }
+        static Tensor<S> contiguous(const Tensor<S>& v){
+            return v.contiguous();
+        }
+        static constexpr bool column_deltas = false;
+    };
+}
+
+#endif //LAZYDEEP1_TENSOR_HPP
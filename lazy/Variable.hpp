@@ -5,7 +5,10 @@
 #ifndef LAZYDEEP1_VARIABLE_HPP
 #define LAZYDEEP1_VARIABLE_HPP
 
+#include <stdexcept>
+#include <vector>
 #include "Operand.hpp"
+#include "random/Distribution.hpp"
 
 namespace lazy {
     template<typename T>
@@ -29,6 +32,63 @@ namespace lazy {
         const T& eval() override {
             return this->m_value.value();
         }
+
+        /*
+         * Column access (embedding tables)
+         * The embedding and the optimizers read and update a table through these, a few columns at
+         * a time, so a variable that does not keep its value in memory (MappedVariable) can override them.
+         */
+
+        using Scalar = typename T::Scalar;
+        using Column = Eigen::Map<Eigen::Matrix<Scalar, Eigen::Dynamic, 1>>;
+        using ColumnFunction = std::function<void(std::size_t, Column)>;
+
+        // shape of the table (without reading it)
+        virtual Index rows(){
+            if constexpr (value_traits<T>::column_deltas) return eval().rows();
+            else throw std::runtime_error("lazy: columns of a variable that is not a matrix");
+        }
+        virtual Index cols(){
+            if constexpr (value_traits<T>::column_deltas) return eval().cols();
+            else throw std::runtime_error("lazy: columns of a variable that is not a matrix");
+        }
+
+        // out.col(k) = column columns[k]
+        virtual void readColumns(const std::vector<Index>& columns, T& out){
+            if constexpr (value_traits<T>::column_deltas) {
+                const T& value = eval();
+                out.resize(value.rows(), static_cast<Index>(columns.size()));
+                for(std::size_t k = 0; k < columns.size(); ++k) out.col(static_cast<Index>(k)) = value.col(columns[k]);
+            } else {
+                throw std::runtime_error("lazy: columns of a variable that is not a matrix");
+            }
+        }
+
+        // f(k, column columns[k]) modifies the columns in place; what depends on them is reset as by an assignment
+        virtual void updateColumns(const std::vector<Index>& columns, const ColumnFunction& f){
+            if constexpr (value_traits<T>::column_deltas) {
+                T& value = this->m_value.value();
+                for(std::size_t k = 0; k < columns.size(); ++k)
+                    f(k, Column(value.col(columns[k]).data(), value.rows()));
+                resetPost();
+            } else {
+                throw std::runtime_error("lazy: columns of a variable that is not a matrix");
+            }
+        }
+
+        // zero variable of the same shape and kind, for state an optimizer keeps per column
+        virtual std::shared_ptr<Variable<T>> makeSlot(){
+            return std::make_shared<Variable<T>>(value_traits<T>::zeros_like(eval()));
+        }
+
+    protected:
+        void resetPost(){
+            if(this->m_post.empty()){
+                this->resetDelta();
+            } else {
+                for(const auto& ptr: this->m_post) ptr->resetValue();
+            }
+        }
     };
 
     template<typename T, typename ...Types>
@@ -48,19 +108,66 @@ namespace lazy {
     template<typename T>
     decltype(auto) random_normal_matrix_variable(Index rows, Index cols, T mean=0.0, T stddev=1.0) {
         auto ret = make_variable<Matrix<T>>();
-        std::random_device rd;
-        std::mt19937 gen{rd()};
-        std::normal_distribution<T> nd(mean, stddev);
+        auto gen = random::make_generator();
 
         Matrix<T> m(rows, cols);
-        for(Index i = 0; i < rows; ++i) {
-            for (Index j = 0; j < cols; ++j)
-                m(i, j) = nd(gen);
-        }
+        random::fill_normal(m, mean, stddev, gen);
+
+        *ret = m;
+        return ret;
+    }
+
+    template<typename T>
+    decltype(auto) random_uniform_matrix_variable(Index rows, Index cols, T low=0.0, T high=1.0) {
+        auto ret = make_variable<Matrix<T>>();
+        auto gen = random::make_generator();
+
+        Matrix<T> m(rows, cols);
+        random::fill_uniform(m, low, high, gen);
 
         *ret = m;
         return ret;
     }
+
+    template<typename T>
+    decltype(auto) truncated_normal_matrix_variable(Index rows, Index cols, T mean=0.0, T stddev=1.0) {
+        auto ret = make_variable<Matrix<T>>();
+        auto gen = random::make_generator();
+
+        Matrix<T> m(rows, cols);
+        random::fill_truncated_normal(m, mean, stddev, gen);
+
+        *ret = m;
+        return ret;
+    }
+
+    /*
+     * initializers for weights of dot_product(W, x) : W is (fan_out x fan_in)
+     */
+
+    // He et al. : normal(0, 2 / fan_in), for relu layers
+    template<typename T>
+    decltype(auto) he_normal_matrix_variable(Index rows, Index cols) {
+        return random_normal_matrix_variable<T>(rows, cols, 0, std::sqrt(T(2) / cols));
+    }
+
+    template<typename T>
+    decltype(auto) he_uniform_matrix_variable(Index rows, Index cols) {
+        const T limit = std::sqrt(T(6) / cols);
+        return random_uniform_matrix_variable<T>(rows, cols, -limit, limit);
+    }
+
+    // Glorot & Bengio : variance 2 / (fan_in + fan_out), for tanh/sigmoid layers
+    template<typename T>
+    decltype(auto) xavier_normal_matrix_variable(Index rows, Index cols) {
+        return random_normal_matrix_variable<T>(rows, cols, 0, std::sqrt(T(2) / (rows + cols)));
+    }
+
+    template<typename T>
+    decltype(auto) xavier_uniform_matrix_variable(Index rows, Index cols) {
+        const T limit = std::sqrt(T(6) / (rows + cols));
+        return random_uniform_matrix_variable<T>(rows, cols, -limit, limit);
+    }
 }
 
 #endif //LAZYDEEP1_VARIABLE_HPP
@@ -0,0 +1,269 @@
+#ifndef LAZYDEEP1_AUGMENT_HPP
+#define LAZYDEEP1_AUGMENT_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <type_traits>
+#include "../Operand.hpp"
+#include "../random/Distribution.hpp"
+
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+namespace lazy::data {
+
+    /*
+     * Augmentation : random image transforms applied to a whole batch in place
+     *
+     * Every column of the batch is one image of `channels` planes of height x width pixels
+     * in row-major order (the MNIST layout). Stages are chained at construction,
+     *
+     *   data::Augmentation<ByteMat> aug(28, 28);
+     *   aug.shift(2).rotate(10).noise(8);
+     *
+     * and run as aug(batch, gen). Shift, crop and rotate are folded into one affine map
+     * per image, resampled once (bilinear, zero outside the image); noise is added to the
+     * whole batch at once. Integer batches are rounded and clamped to their range.
+     * operator() is const and keeps its scratch per thread, so the loader workers can share
+     * one Augmentation, each drawing from its own generator.
+     */
+
+    template<typename T>
+    class Augmentation {
+    public:
+        using ScalarType = typename T::Scalar;
+
+        Augmentation(Index height, Index width, Index channels = 1)
+        : m_height(height), m_width(width), m_channels(channels) {
+
+        }
+
+        // translation of up to max_pixels on each axis (whole pixels)
+        Augmentation& shift(Index max_pixels){
+            m_shift = max_pixels;
+            return *this;
+        }
+
+        // a random window of [min_scale, 1] of each side, stretched back to the full image
+        Augmentation& crop(double min_scale){
+            m_min_scale = min_scale;
+            return *this;
+        }
+
+        // rotation about the center of up to max_degrees either way
+        Augmentation& rotate(double max_degrees){
+            constexpr double pi = 3.14159265358979323846;
+            m_max_angle = max_degrees * pi / 180.0;
+            return *this;
+        }
+
+        // additive gaussian noise, clamped to [low, high]
+        Augmentation& noise(double stddev,
+                double low = std::numeric_limits<double>::lowest(),
+                double high = std::numeric_limits<double>::max()){
+            m_noise = stddev;
+            m_low = low;
+            m_high = high;
+            return *this;
+        }
+
+        void operator()(T& batch, random::Philox& gen) const {
+            if(batch.rows() != m_height * m_width * m_channels)
+                throw std::runtime_error("lazy: augmentation does not match the image size");
+
+            if(m_shift > 0 || m_min_scale < 1 || m_max_angle > 0){
+                for(Index i = 0; i < batch.cols(); ++i)
+                    warp(batch.col(i).data(), sample(gen));
+            }
+
+            if(m_noise > 0)
+                addNoise(batch, gen);
+        }
+
+    private:
+        Index m_height, m_width, m_channels;
+
+        Index m_shift = 0;
+        double m_min_scale = 1;
+        double m_max_angle = 0;
+        double m_noise = 0;
+        double m_low = 0, m_high = 0;
+
+        // source = A * (destination - center) + center + b
+        struct Affine {
+            float a00, a01, a10, a11;
+            float bx, by;
+        };
+
+        Affine sample(random::Philox& gen) const {
+            std::uniform_real_distribution<double> unit(0, 1);
+
+            const double angle = m_max_angle * (2 * unit(gen) - 1);
+            const double scale = m_min_scale + (1 - m_min_scale) * unit(gen);
+            const double c = std::cos(angle) * scale, s = std::sin(angle) * scale;
+
+            // the crop window moves anywhere inside the image
+            double bx = (1 - scale) * (unit(gen) - 0.5) * m_width;
+            double by = (1 - scale) * (unit(gen) - 0.5) * m_height;
+            if(m_shift > 0){
+                std::uniform_int_distribution<Index> pixels(-m_shift, m_shift);
+                bx += static_cast<double>(pixels(gen));
+                by += static_cast<double>(pixels(gen));
+            }
+            return {float(c), float(-s), float(s), float(c), float(bx), float(by)};
+        }
+
+        static ScalarType store(float v){
+            if constexpr(std::is_integral_v<ScalarType>){
+                constexpr float lo = static_cast<float>(std::numeric_limits<ScalarType>::lowest());
+                constexpr float hi = static_cast<float>(std::numeric_limits<ScalarType>::max());
+                return static_cast<ScalarType>(std::floor(std::min(std::max(v, lo), hi) + 0.5f));
+            } else {
+                return static_cast<ScalarType>(v);
+            }
+        }
+
+        void warp(ScalarType* image, const Affine& m) const {
+            // locals, so the pixel loops do not reload the sizes through `this`
+            const Index height = m_height, width = m_width;
+
+            // each plane is copied into a float buffer with a zero border (1 before, 2 after),
+            // so the clamped source coordinates never need a bounds check
+            const Index pw = width + 3, ph = height + 3;
+            thread_local std::vector<float> padded, row;
+            padded.assign(static_cast<std::size_t>(pw * ph), 0.f);
+            row.resize(static_cast<std::size_t>(width));
+
+            const float cx = 0.5f * float(width - 1), cy = 0.5f * float(height - 1);
+            const float max_x = float(width), max_y = float(height);
+
+            for(Index ch = 0; ch < m_channels; ++ch){
+                ScalarType* plane = image + ch * height * width;
+                float* dst = padded.data();
+                for(Index r = 0; r < height; ++r)
+                    for(Index c = 0; c < width; ++c)
+                        dst[(r + 1) * pw + c + 1] = static_cast<float>(plane[r * width + c]);
+
+                for(Index r = 0; r < height; ++r){
+                    const float dy = float(r) - cy;
+                    // source of pixel (r, c) : (x0 + a00 * c, y0 + a10 * c)
+                    const float x0 = m.a01 * dy + cx + m.bx - m.a00 * cx;
+                    const float y0 = m.a11 * dy + cy + m.by - m.a10 * cx;
+                    float* line = row.data();
+                    resample_row(padded.data(), pw, width, x0, m.a00, y0, m.a10, max_x, max_y, line);
+
+                    ScalarType* out = plane + r * width;
+                    for(Index c = 0; c < width; ++c)
+                        out[c] = store(line[c]);
+                }
+            }
+        }
+
+        /*
+         * one output row, bilinear from the padded plane
+         * 16 (AVX-512) or 8 (AVX2) pixels at a time, with the four taps gathered per lane
+         */
+
+        static void resample_row(const float* src, Index pw, Index width, float x0, float ax,
+                float y0, float ay, float max_x, float max_y, float* row){
+#if defined(__AVX512F__)
+            const __m512 lane = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+            const __m512 lo = _mm512_set1_ps(-1.f);
+            const __mmask16 all = 0xFFFF;
+            const __m512i one = _mm512_set1_epi32(1), stride = _mm512_set1_epi32(static_cast<int>(pw));
+            for(Index c = 0; c < width; c += 16){
+                const __mmask16 m = width - c >= 16 ? all : __mmask16((1u << (width - c)) - 1);
+                const __m512 col = _mm512_add_ps(_mm512_set1_ps(float(c)), lane);
+                // (full-mask maskz forms: the plain min/max/cvt warn about an undefined source on GCC 12)
+                const __m512 sx = _mm512_maskz_min_ps(all, _mm512_maskz_max_ps(all,
+                        _mm512_fmadd_ps(_mm512_set1_ps(ax), col, _mm512_set1_ps(x0)), lo), _mm512_set1_ps(max_x));
+                const __m512 sy = _mm512_maskz_min_ps(all, _mm512_maskz_max_ps(all,
+                        _mm512_fmadd_ps(_mm512_set1_ps(ay), col, _mm512_set1_ps(y0)), lo), _mm512_set1_ps(max_y));
+                const __m512 fx = _mm512_floor_ps(sx), fy = _mm512_floor_ps(sy);
+                const __m512 wx = _mm512_sub_ps(sx, fx), wy = _mm512_sub_ps(sy, fy);
+
+                const __m512i k = _mm512_add_epi32(
+                        _mm512_mullo_epi32(_mm512_add_epi32(_mm512_maskz_cvtps_epi32(all, fy), one), stride),
+                        _mm512_add_epi32(_mm512_maskz_cvtps_epi32(all, fx), one));
+                const __m512i kb = _mm512_add_epi32(k, stride);
+                const __m512 zero = _mm512_setzero_ps();
+                const __m512 p00 = _mm512_mask_i32gather_ps(zero, m, k, src, 4);
+                const __m512 p01 = _mm512_mask_i32gather_ps(zero, m, _mm512_add_epi32(k, one), src, 4);
+                const __m512 p10 = _mm512_mask_i32gather_ps(zero, m, kb, src, 4);
+                const __m512 p11 = _mm512_mask_i32gather_ps(zero, m, _mm512_add_epi32(kb, one), src, 4);
+
+                const __m512 top = _mm512_fmadd_ps(wx, _mm512_sub_ps(p01, p00), p00);
+                const __m512 bottom = _mm512_fmadd_ps(wx, _mm512_sub_ps(p11, p10), p10);
+                _mm512_mask_storeu_ps(row + c, m, _mm512_fmadd_ps(wy, _mm512_sub_ps(bottom, top), top));
+            }
+#elif defined(__AVX2__) && defined(__FMA__)
+            const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+            const __m256 lo = _mm256_set1_ps(-1.f);
+            const __m256i one = _mm256_set1_epi32(1), stride = _mm256_set1_epi32(static_cast<int>(pw));
+            const __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            for(Index c = 0; c < width; c += 8){
+                // lanes past the end of the row are neither read nor stored
+                const __m256i m = _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(std::min<Index>(width - c, 8))), index);
+                const __m256 mf = _mm256_castsi256_ps(m);
+                const __m256 col = _mm256_add_ps(_mm256_set1_ps(float(c)), lane);
+                const __m256 sx = _mm256_min_ps(_mm256_max_ps(
+                        _mm256_fmadd_ps(_mm256_set1_ps(ax), col, _mm256_set1_ps(x0)), lo), _mm256_set1_ps(max_x));
+                const __m256 sy = _mm256_min_ps(_mm256_max_ps(
+                        _mm256_fmadd_ps(_mm256_set1_ps(ay), col, _mm256_set1_ps(y0)), lo), _mm256_set1_ps(max_y));
+                const __m256 fx = _mm256_floor_ps(sx), fy = _mm256_floor_ps(sy);
+                const __m256 wx = _mm256_sub_ps(sx, fx), wy = _mm256_sub_ps(sy, fy);
+
+                const __m256i k = _mm256_add_epi32(
+                        _mm256_mullo_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fy), one), stride),
+                        _mm256_add_epi32(_mm256_cvtps_epi32(fx), one));
+                const __m256i kb = _mm256_add_epi32(k, stride);
+                const __m256 zero = _mm256_setzero_ps();
+                const __m256 p00 = _mm256_mask_i32gather_ps(zero, src, k, mf, 4);
+                const __m256 p01 = _mm256_mask_i32gather_ps(zero, src, _mm256_add_epi32(k, one), mf, 4);
+                const __m256 p10 = _mm256_mask_i32gather_ps(zero, src, kb, mf, 4);
+                const __m256 p11 = _mm256_mask_i32gather_ps(zero, src, _mm256_add_epi32(kb, one), mf, 4);
+
+                const __m256 top = _mm256_fmadd_ps(wx, _mm256_sub_ps(p01, p00), p00);
+                const __m256 bottom = _mm256_fmadd_ps(wx, _mm256_sub_ps(p11, p10), p10);
+                _mm256_maskstore_ps(row + c, m, _mm256_fmadd_ps(wy, _mm256_sub_ps(bottom, top), top));
+            }
+#else
+            for(Index c = 0; c < width; ++c){
+                const float sx = std::min(std::max(x0 + ax * float(c), -1.f), max_x);
+                const float sy = std::min(std::max(y0 + ay * float(c), -1.f), max_y);
+                const float fx = std::floor(sx), fy = std::floor(sy);
+                const float wx = sx - fx, wy = sy - fy;
+                const Index k = (static_cast<Index>(fy) + 1) * pw + static_cast<Index>(fx) + 1;
+
+                const float top = src[k] + wx * (src[k + 1] - src[k]);
+                const float bottom = src[k + pw] + wx * (src[k + pw + 1] - src[k + pw]);
+                row[c] = top + wy * (bottom - top);
+            }
+#endif
+        }
+
+        void addNoise(T& batch, random::Philox& gen) const {
+            thread_local Matrix<float> noise;
+            noise.resize(batch.rows(), batch.cols());
+            random::fill_normal(noise, 0.f, static_cast<float>(m_noise), gen);
+
+            const float lo = static_cast<float>(std::max<double>(m_low, std::numeric_limits<float>::lowest()));
+            const float hi = static_cast<float>(std::min<double>(m_high, std::numeric_limits<float>::max()));
+            if constexpr(std::is_integral_v<ScalarType>){
+                ScalarType* data = batch.data();
+                const float* n = noise.data();
+                const Index size = batch.size();
+                for(Index k = 0; k < size; ++k)
+                    data[k] = store(std::min(std::max(static_cast<float>(data[k]) + n[k], lo), hi));
+            } else {
+                batch = (batch + noise.template cast<ScalarType>())
+                        .cwiseMax(static_cast<ScalarType>(lo)).cwiseMin(static_cast<ScalarType>(hi));
+            }
+        }
+    };
+}
+
+#endif //LAZYDEEP1_AUGMENT_HPP
@@ -0,0 +1,232 @@
+#ifndef LAZYDEEP1_DATALOADER_HPP
+#define LAZYDEEP1_DATALOADER_HPP
+
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <numeric>
+#include <vector>
+#include "../Operand.hpp"
+#include "../random/Philox.hpp"
+
+namespace lazy::data {
+
+    struct LoaderOptions {
+        unsigned workers = 2;       // background threads filling batches
+        unsigned prefetch = 4;      // batch buffers in the ring
+        bool shuffle = true;        // new order of samples on every epoch
+        bool drop_last = true;      // skip the last batch if it is not full
+    };
+
+    /*
+     * DataLoader : prepares batches on background threads
+     *
+     * fill(indices, count, input, label) writes samples indices[0..count) into the columns
+     * of the (preallocated) input/label buffers; it must write every entry it uses.
+     * Batches come out of next() in order, while the workers fill the following ones
+     * into the other buffers of the ring.
+     *
+     *   loader.start_epoch();
+     *   while(auto batch = loader.next()) { ... batch->input, batch->label ... }
+     *
+     * A batch stays valid until the next call of next() or start_epoch().
+     * An exception thrown while filling a batch is rethrown by the next() that would have
+     * returned it; that batch is skipped, and the following next() goes on with the epoch.
+     * Input and label may have different types (e.g. raw uint8 images and float one-hot labels).
+     * The shuffle is drawn from a lazy::random stream, so it follows random::set_seed().
+     *
+     * augment(f) adds a stage run by the worker right after fill, f(input, label, gen),
+     * with a generator of its own per worker (e.g. a data::Augmentation).
+     * Which worker fills which batch is up to the scheduler, so augmented batches are
+     * reproducible only with a single worker.
+     */
+
+    template<typename Input, typename Label = Input>
+    class DataLoader {
+    public:
+        struct Batch {
+            Input input;
+            Label label;
+            Index number = 0;   // position in the epoch
+            Index size = 0;     // number of samples (columns)
+        };
+
+        using FillFunction = std::function<void(const Index*, Index, Input&, Label&)>;
+        using AugmentFunction = std::function<void(Input&, Label&, random::Philox&)>;
+
+        DataLoader(Index samples, Index batch_size, Index input_rows, Index label_rows,
+                FillFunction fill, const LoaderOptions& options = LoaderOptions())
+        : m_samples(samples), m_batch_size(batch_size), m_fill(std::move(fill)), m_options(options),
+        m_order(static_cast<std::size_t>(samples)), m_gen(random::make_generator()),
+        m_slots(std::max(1u, options.prefetch)), m_state(m_slots.size(), SlotState::Free), m_errors(m_slots.size()) {
+            std::iota(m_order.begin(), m_order.end(), Index(0));
+            for(auto& slot: m_slots){
+                slot.input.resize(input_rows, batch_size);
+                slot.label.resize(label_rows, batch_size);
+            }
+
+            for(unsigned i = 0; i < std::max(1u, options.workers); ++i)
+                m_workers.emplace_back([this, gen = random::make_generator()]() mutable { work(gen); });
+        }
+
+        // Anything about Copy/Move is inhibited
+        DataLoader(const DataLoader&) = delete;
+        DataLoader& operator=(const DataLoader&) = delete;
+        DataLoader(DataLoader&&) = delete;
+        DataLoader& operator=(DataLoader&&) = delete;
+
+        ~DataLoader(){
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_work.notify_all();
+            for(auto& w: m_workers) w.join();
+        }
+
+        // drops the batches of the previous epoch and starts filling the new one
+        void start_epoch(){
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_filled.wait(lock, [this](){
+                return std::none_of(m_state.begin(), m_state.end(), [](SlotState s){
+                    return s == SlotState::Filling;
+                });
+            });
+
+            std::fill(m_state.begin(), m_state.end(), SlotState::Free);
+            std::fill(m_errors.begin(), m_errors.end(), nullptr);
+            if(m_options.shuffle)
+                std::shuffle(m_order.begin(), m_order.end(), m_gen);
+
+            m_batches = m_options.drop_last ? m_samples / m_batch_size
+                    : (m_samples + m_batch_size - 1) / m_batch_size;
+            m_next_job = 0;
+            m_next_out = 0;
+            m_current = -1;
+            ++m_epoch;
+
+            lock.unlock();
+            m_work.notify_all();
+        }
+
+        // the next batch of the epoch, nullptr at the end
+        const Batch* next(){
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if(m_current >= 0){
+                m_state[m_current] = SlotState::Free;
+                m_current = -1;
+                m_work.notify_all();
+            }
+
+            if(m_next_out >= m_batches)
+                return nullptr;
+
+            const auto slot = static_cast<std::size_t>(m_next_out % slotCount());
+            m_filled.wait(lock, [this, slot](){
+                return m_state[slot] == SlotState::Ready;
+            });
+
+            ++m_next_out;
+            if(m_errors[slot]){
+                auto error = std::move(m_errors[slot]);
+                m_errors[slot] = nullptr;
+                m_state[slot] = SlotState::Free;
+                lock.unlock();
+                m_work.notify_all();
+                std::rethrow_exception(error);
+            }
+
+            m_current = static_cast<long>(slot);
+            return &m_slots[slot];
+        }
+
+        // set before start_epoch()
+        void augment(AugmentFunction f){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_augment = std::move(f);
+        }
+
+        Index batches() const noexcept {
+            return m_batches;
+        }
+
+        Index epoch() const noexcept {
+            return m_epoch;
+        }
+
+    private:
+        enum class SlotState { Free, Filling, Ready };
+
+        Index m_samples;
+        Index m_batch_size;
+        FillFunction m_fill;
+        AugmentFunction m_augment;
+        LoaderOptions m_options;
+
+        std::vector<Index> m_order;
+        random::Philox m_gen;
+
+        std::vector<Batch> m_slots;
+        std::vector<SlotState> m_state;
+        std::vector<std::exception_ptr> m_errors;   // of the batch in each slot
+
+        Index m_batches = 0;
+        Index m_next_job = 0;
+        Index m_next_out = 0;
+        Index m_epoch = 0;
+        long m_current = -1;
+        bool m_stop = false;
+
+        std::mutex m_mutex;
+        std::condition_variable m_work;     // a job or a free slot is available
+        std::condition_variable m_filled;   // a slot became ready
+        std::vector<std::thread> m_workers;
+
+        Index slotCount() const noexcept {
+            return static_cast<Index>(m_slots.size());
+        }
+
+        void work(random::Philox& gen){
+            std::unique_lock<std::mutex> lock(m_mutex);
+            for(;;){
+                // batch b goes to slot b % slots, once batch b - slots has been handed back
+                m_work.wait(lock, [this](){
+                    return m_stop || (m_next_job < m_batches
+                            && m_state[m_next_job % slotCount()] == SlotState::Free);
+                });
+                if(m_stop) return;
+
+                const Index number = m_next_job++;
+                const auto slot = static_cast<std::size_t>(number % slotCount());
+                m_state[slot] = SlotState::Filling;
+                auto& batch = m_slots[slot];
+                const Index first = number * m_batch_size;
+                const Index count = std::min(m_batch_size, m_samples - first);
+
+                lock.unlock();
+                std::exception_ptr error;
+                try {
+                    if(batch.input.cols() != count){
+                        batch.input.resize(batch.input.rows(), count);
+                        batch.label.resize(batch.label.rows(), count);
+                    }
+                    batch.number = number;
+                    batch.size = count;
+                    m_fill(m_order.data() + first, count, batch.input, batch.label);
+                    if(m_augment) m_augment(batch.input, batch.label, gen);
+                } catch(...) {
+                    error = std::current_exception();
+                }
+                lock.lock();
+
+                m_errors[slot] = error;
+                m_state[slot] = SlotState::Ready;
+                m_filled.notify_all();
+            }
+        }
+    };
+}
+
+#endif //LAZYDEEP1_DATALOADER_HPP
@@ -0,0 +1,275 @@
+#ifndef LAZYDEEP1_IDXFILE_HPP
+#define LAZYDEEP1_IDXFILE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../Operand.hpp"
+
+namespace lazy::data {
+
+    /*
+     * IDX file (the MNIST format)
+     * magic : 0x00 0x00 <type> <number of dimensions>, then each dimension as big-endian uint32,
+     * then the payload in row-major order, big-endian.
+     */
+
+    enum class idx_type : std::uint8_t {
+        uint8 = 0x08,
+        int8 = 0x09,
+        int16 = 0x0B,
+        int32 = 0x0C,
+        float32 = 0x0D,
+        float64 = 0x0E
+    };
+
+    inline std::size_t idx_type_size(idx_type type){
+        switch(type){
+            case idx_type::uint8:
+            case idx_type::int8: return 1;
+            case idx_type::int16: return 2;
+            case idx_type::int32:
+            case idx_type::float32: return 4;
+            case idx_type::float64: return 8;
+        }
+        return 0;
+    }
+
+    // expected access pattern, forwarded to madvise()
+    enum class access {
+        normal,
+        sequential,
+        random,
+        will_need
+    };
+
+    /*
+     * IdxFile : memory-mapped IDX file
+     *
+     * The payload is never copied: pages are read by the kernel when they are touched,
+     * so opening a file costs the same whatever its size.
+     * Dimension 0 indexes samples; one sample is the product of the other dimensions,
+     * and view(first, n) shows samples as the columns of a (sampleSize x n) matrix.
+     *
+     * Errors (missing file, bad header, truncated payload) throw std::runtime_error.
+     */
+
+    class IdxFile {
+    public:
+        explicit IdxFile(const std::string& path){
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0)
+                throw std::runtime_error("lazy: cannot open " + path);
+
+            // the mapping stays valid after the descriptor is closed
+            struct stat st{};
+            void* addr = MAP_FAILED;
+            if(::fstat(fd, &st) == 0 && st.st_size >= 4){
+                m_length = static_cast<std::size_t>(st.st_size);
+                addr = ::mmap(nullptr, m_length, PROT_READ, MAP_SHARED, fd, 0);
+            }
+            ::close(fd);
+            if(addr == MAP_FAILED)
+                throw std::runtime_error("lazy: cannot map " + path);
+            m_map = static_cast<const std::uint8_t*>(addr);
+
+            try {
+                parseHeader(path);
+            } catch(...) {
+                close();
+                throw;
+            }
+        }
+
+        IdxFile(const IdxFile&) = delete;
+        IdxFile& operator=(const IdxFile&) = delete;
+
+        IdxFile(IdxFile&& other) noexcept {
+            *this = std::move(other);
+        }
+
+        IdxFile& operator=(IdxFile&& other) noexcept {
+            if(this != &other){
+                close();
+                m_map = other.m_map;
+                m_length = other.m_length;
+                m_type = other.m_type;
+                m_dims = std::move(other.m_dims);
+                m_payload = other.m_payload;
+                m_sample_size = other.m_sample_size;
+                other.m_map = nullptr;
+                other.m_length = 0;
+            }
+            return *this;
+        }
+
+        ~IdxFile(){
+            close();
+        }
+
+        /*
+         * header
+         */
+
+        idx_type type() const noexcept {
+            return m_type;
+        }
+
+        const std::vector<Index>& dims() const noexcept {
+            return m_dims;
+        }
+
+        // number of samples (dimension 0)
+        Index count() const noexcept {
+            return m_dims.empty() ? 0 : m_dims[0];
+        }
+
+        // elements of one sample
+        Index sampleSize() const noexcept {
+            return m_sample_size;
+        }
+
+        /*
+         * payload
+         */
+
+        // samples [first, first + n) as columns, without copying (1-byte types only)
+        template<typename S = std::uint8_t>
+        Eigen::Map<const Matrix<S>> view(Index first, Index n) const {
+            static_assert(sizeof(S) == 1, "lazy: only 1-byte IDX data can be viewed in place");
+            checkType<S>();
+            checkRange(first, n);
+            return Eigen::Map<const Matrix<S>>(
+                    reinterpret_cast<const S*>(m_payload) + first * m_sample_size, m_sample_size, n);
+        }
+
+        // element i of sample s, converted from the big-endian payload
+        template<typename S>
+        S at(Index s, Index i = 0) const {
+            return element<S>(s * m_sample_size + i);
+        }
+
+        // samples [first, first + n) converted into the columns of out (any IDX type)
+        template<typename T>
+        void read(Index first, Index n, T& out) const {
+            using S = typename T::Scalar;
+            checkRange(first, n);
+            out.resize(m_sample_size, n);
+            S* dst = out.data();
+            const Index begin = first * m_sample_size;
+            for(Index k = 0; k < n * m_sample_size; ++k)
+                dst[k] = element<S>(begin + k);
+        }
+
+        // hint the access pattern of samples [first, first + n) (the whole payload by default)
+        void advise(access pattern, Index first = 0, Index n = -1) const {
+            if(n < 0) n = count() - first;
+            checkRange(first, n);
+
+            const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+            const std::size_t elem = idx_type_size(m_type);
+            auto begin = static_cast<std::size_t>(m_payload - m_map) + first * m_sample_size * elem;
+            auto end = begin + static_cast<std::size_t>(n * m_sample_size) * elem;
+            begin -= begin % page;
+
+            int advice = MADV_NORMAL;
+            switch(pattern){
+                case access::normal: advice = MADV_NORMAL; break;
+                case access::sequential: advice = MADV_SEQUENTIAL; break;
+                case access::random: advice = MADV_RANDOM; break;
+                case access::will_need: advice = MADV_WILLNEED; break;
+            }
+            ::madvise(const_cast<std::uint8_t*>(m_map) + begin, end - begin, advice);
+        }
+
+    private:
+        const std::uint8_t* m_map = nullptr;
+        std::size_t m_length = 0;
+
+        idx_type m_type = idx_type::uint8;
+        std::vector<Index> m_dims;
+        const std::uint8_t* m_payload = nullptr;
+        Index m_sample_size = 0;
+
+        void close() noexcept {
+            if(m_map) ::munmap(const_cast<std::uint8_t*>(m_map), m_length);
+            m_map = nullptr;
+        }
+
+        static std::uint32_t bigEndian32(const std::uint8_t* p) noexcept {
+            return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+        }
+
+        void parseHeader(const std::string& path){
+            if(m_map[0] != 0 || m_map[1] != 0 || idx_type_size(static_cast<idx_type>(m_map[2])) == 0)
+                throw std::runtime_error("lazy: " + path + " is not an IDX file");
+            m_type = static_cast<idx_type>(m_map[2]);
+
+            const std::size_t ndims = m_map[3];
+            const std::size_t header = 4 + 4 * ndims;
+            if(ndims == 0 || m_length < header)
+                throw std::runtime_error("lazy: bad IDX header in " + path);
+
+            // the sizes are checked for overflow : a crafted header must not wrap the length check
+            m_sample_size = 1;
+            for(std::size_t d = 0; d < ndims; ++d){
+                m_dims.push_back(static_cast<Index>(bigEndian32(m_map + 4 + 4 * d)));
+                if(d > 0 && __builtin_mul_overflow(m_sample_size, m_dims.back(), &m_sample_size))
+                    throw std::runtime_error("lazy: bad IDX header in " + path);
+            }
+
+            m_payload = m_map + header;
+            Index elements;
+            std::size_t bytes;
+            if(__builtin_mul_overflow(m_dims[0], m_sample_size, &elements)
+                    || __builtin_mul_overflow(static_cast<std::size_t>(elements), idx_type_size(m_type), &bytes))
+                throw std::runtime_error("lazy: bad IDX header in " + path);
+            if(m_length - header < bytes)
+                throw std::runtime_error("lazy: " + path + " is shorter than its header says");
+        }
+
+        template<typename S>
+        void checkType() const {
+            const bool ok = std::is_signed_v<S> ? m_type == idx_type::int8 : m_type == idx_type::uint8;
+            if(!ok)
+                throw std::runtime_error("lazy: IDX view of the wrong type");
+        }
+
+        void checkRange(Index first, Index n) const {
+            if(first < 0 || n < 0 || first + n > count())
+                throw std::runtime_error("lazy: IDX samples out of range");
+        }
+
+        template<typename U>
+        U load(Index k) const noexcept {
+            // big-endian bytes of element k, reversed for the (little-endian) host
+            const std::uint8_t* p = m_payload + k * sizeof(U);
+            std::uint8_t bytes[sizeof(U)];
+            for(std::size_t b = 0; b < sizeof(U); ++b) bytes[b] = p[sizeof(U) - 1 - b];
+            U ret;
+            std::memcpy(&ret, bytes, sizeof(U));
+            return ret;
+        }
+
+        template<typename S>
+        S element(Index k) const noexcept {
+            switch(m_type){
+                case idx_type::uint8: return static_cast<S>(m_payload[k]);
+                case idx_type::int8: return static_cast<S>(static_cast<std::int8_t>(m_payload[k]));
+                case idx_type::int16: return static_cast<S>(load<std::int16_t>(k));
+                case idx_type::int32: return static_cast<S>(load<std::int32_t>(k));
+                case idx_type::float32: return static_cast<S>(load<float>(k));
+                case idx_type::float64: return static_cast<S>(load<double>(k));
+            }
+            return S(0);
+        }
+    };
+}
+
+#endif //LAZYDEEP1_IDXFILE_HPP
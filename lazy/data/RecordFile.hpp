@@ -0,0 +1,486 @@
+#ifndef LAZYDEEP1_RECORDFILE_HPP
+#define LAZYDEEP1_RECORDFILE_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../Operand.hpp"
+#include "../random/Philox.hpp"
+
+namespace lazy::data {
+
+    /*
+     * Sharded record files
+     *
+     * A dataset is a series of shards <prefix>-00000.rec, <prefix>-00001.rec, ...
+     * each holding variable-size records:
+     *
+     *   header  : "LZR1" | u32 0 | u64 records | u64 index offset
+     *   payload : the records, back to back
+     *   index   : (records + 1) u64 offsets of the records in the file
+     *
+     * (native byte order). The reader keeps only the indices in memory (8 bytes a record)
+     * and reads records through mmap or pread.
+     */
+
+    namespace detail {
+        constexpr char record_magic[4] = {'L', 'Z', 'R', '1'};
+        constexpr std::size_t record_header_size = 24;
+
+        inline std::string shard_name(const std::string& prefix, std::size_t shard){
+            char suffix[16];
+            std::snprintf(suffix, sizeof(suffix), "-%05zu.rec", shard);
+            return prefix + suffix;
+        }
+
+        // reads exactly size bytes at offset (pread may return less)
+        inline void pread_all(int fd, void* buf, std::size_t size, std::size_t offset){
+            auto* p = static_cast<char*>(buf);
+            while(size > 0){
+                const ssize_t r = ::pread(fd, p, size, static_cast<off_t>(offset));
+                if(r <= 0)
+                    throw std::runtime_error("lazy: failed to read a record shard");
+                p += r;
+                offset += static_cast<std::size_t>(r);
+                size -= static_cast<std::size_t>(r);
+            }
+        }
+    }
+
+    /*
+     * RecordWriter : appends records and starts a new shard every shard_bytes of payload
+     */
+
+    class RecordWriter {
+    public:
+        explicit RecordWriter(std::string prefix, std::size_t shard_bytes = std::size_t(256) << 20)
+        : m_prefix(std::move(prefix)), m_shard_bytes(shard_bytes) {
+
+        }
+
+        RecordWriter(const RecordWriter&) = delete;
+        RecordWriter& operator=(const RecordWriter&) = delete;
+
+        ~RecordWriter(){
+            try {
+                close();
+            } catch(...) {
+                // nothing to report from a destructor
+            }
+        }
+
+        void write(const void* data, std::size_t size){
+            if(!m_file || m_offsets.back() - detail::record_header_size >= m_shard_bytes)
+                openShard();
+            if(size && std::fwrite(data, 1, size, m_file) != size)
+                throw std::runtime_error("lazy: failed to write a record");
+            m_offsets.push_back(m_offsets.back() + size);
+            ++m_records;
+        }
+
+        // a dense matrix as one record of its raw elements
+        template<typename T>
+        void write(const Eigen::DenseBase<T>& m){
+            const typename T::PlainObject plain = m;
+            write(plain.data(), sizeof(typename T::Scalar) * static_cast<std::size_t>(plain.size()));
+        }
+
+        // finishes the current shard
+        void close(){
+            if(!m_file) return;
+
+            const std::uint64_t count = m_offsets.size() - 1;
+            const std::uint64_t index = m_offsets.back();
+            bool ok = std::fwrite(m_offsets.data(), sizeof(std::uint64_t), m_offsets.size(), m_file) == m_offsets.size();
+
+            char header[detail::record_header_size] = {};
+            std::memcpy(header, detail::record_magic, 4);
+            std::memcpy(header + 8, &count, 8);
+            std::memcpy(header + 16, &index, 8);
+            ok = ok && std::fseek(m_file, 0, SEEK_SET) == 0
+                    && std::fwrite(header, 1, sizeof(header), m_file) == sizeof(header);
+            ok = std::fclose(m_file) == 0 && ok;
+
+            m_file = nullptr;
+            if(!ok)
+                throw std::runtime_error("lazy: failed to finish a record shard");
+        }
+
+        std::size_t shards() const noexcept {
+            return m_shards;
+        }
+
+        std::size_t records() const noexcept {
+            return m_records;
+        }
+
+    private:
+        std::string m_prefix;
+        std::size_t m_shard_bytes;
+
+        std::FILE* m_file = nullptr;
+        std::vector<std::uint64_t> m_offsets;
+        std::size_t m_shards = 0;
+        std::size_t m_records = 0;
+
+        void openShard(){
+            close();
+            const auto name = detail::shard_name(m_prefix, m_shards);
+            m_file = std::fopen(name.c_str(), "wb");
+            if(!m_file)
+                throw std::runtime_error("lazy: cannot create " + name);
+
+            // the header is written again by close()
+            const char header[detail::record_header_size] = {};
+            if(std::fwrite(header, 1, sizeof(header), m_file) != sizeof(header))
+                throw std::runtime_error("lazy: failed to write " + name);
+
+            m_offsets.assign(1, detail::record_header_size);
+            ++m_shards;
+        }
+    };
+
+    /*
+     * RecordReader : random access to the records of all shards
+     * Record i is found through the in-memory indices; with io::mmap it can be viewed in place,
+     * with io::pread every access is a read into a caller buffer.
+     */
+
+    enum class io {
+        mmap,
+        pread
+    };
+
+    struct RecordView {
+        const std::uint8_t* data;
+        std::size_t size;
+    };
+
+    class RecordReader {
+    public:
+        explicit RecordReader(const std::string& prefix, io mode = io::mmap)
+        : m_mode(mode) {
+            try {
+                for(std::size_t s = 0; ; ++s){
+                    const auto name = detail::shard_name(prefix, s);
+                    const int fd = ::open(name.c_str(), O_RDONLY);
+                    if(fd < 0) break;
+                    m_shards.emplace_back();
+                    m_shards.back().fd = fd;
+                    openShard(m_shards.back(), name);
+                    m_first.push_back(m_records);
+                    m_records += static_cast<Index>(m_shards.back().offsets.size() - 1);
+                }
+                if(m_shards.empty())
+                    throw std::runtime_error("lazy: no record shards for " + prefix);
+            } catch(...) {
+                close();
+                throw;
+            }
+        }
+
+        RecordReader(const RecordReader&) = delete;
+        RecordReader& operator=(const RecordReader&) = delete;
+
+        ~RecordReader(){
+            close();
+        }
+
+        Index size() const noexcept {
+            return m_records;
+        }
+
+        Index shards() const noexcept {
+            return static_cast<Index>(m_shards.size());
+        }
+
+        Index shardSize(Index s) const {
+            return static_cast<Index>(m_shards[s].offsets.size() - 1);
+        }
+
+        // index of the first record of shard s
+        Index shardBegin(Index s) const {
+            return m_first[s];
+        }
+
+        // record i in place (io::mmap only)
+        RecordView view(Index i) const {
+            if(m_mode != io::mmap)
+                throw std::runtime_error("lazy: records can be viewed only through mmap");
+            const auto [shard, k] = locate(i);
+            const auto& sh = m_shards[shard];
+            return {sh.map + sh.offsets[k], static_cast<std::size_t>(sh.offsets[k + 1] - sh.offsets[k])};
+        }
+
+        // record i copied into out
+        void read(Index i, std::vector<std::uint8_t>& out) const {
+            const auto [shard, k] = locate(i);
+            const auto& sh = m_shards[shard];
+            const auto size = static_cast<std::size_t>(sh.offsets[k + 1] - sh.offsets[k]);
+            out.resize(size);
+            if(m_mode == io::mmap){
+                std::memcpy(out.data(), sh.map + sh.offsets[k], size);
+            } else {
+                detail::pread_all(sh.fd, out.data(), size, sh.offsets[k]);
+            }
+        }
+
+        /*
+         * all records of shard s as views, without copying them
+         * io::mmap : views into the mapping (payload is left empty), with read-ahead of the shard
+         * io::pread : one sequential read of the shard payload into payload, and views into it
+         * The views stay valid as long as the reader (and payload) do.
+         */
+        void readShard(Index s, std::vector<std::uint8_t>& payload, std::vector<RecordView>& out) const {
+            const auto& sh = m_shards[s];
+            const auto begin = static_cast<std::size_t>(sh.offsets.front());
+            const auto bytes = static_cast<std::size_t>(sh.offsets.back()) - begin;
+
+            const std::uint8_t* base;     // where the byte at offset `begin` of the file is
+            if(m_mode == io::mmap){
+                payload.clear();
+                const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+                const std::size_t first = begin - begin % page;
+                ::madvise(const_cast<std::uint8_t*>(sh.map) + first, begin + bytes - first, MADV_WILLNEED);
+                base = sh.map + begin;
+            } else {
+                payload.resize(bytes);
+                detail::pread_all(sh.fd, payload.data(), bytes, begin);
+                base = payload.data();
+            }
+
+            out.resize(sh.offsets.size() - 1);
+            for(std::size_t k = 0; k + 1 < sh.offsets.size(); ++k)
+                out[k] = {base + (sh.offsets[k] - begin), static_cast<std::size_t>(sh.offsets[k + 1] - sh.offsets[k])};
+        }
+
+    private:
+        struct Shard {
+            int fd = -1;
+            const std::uint8_t* map = nullptr;
+            std::size_t length = 0;
+            std::vector<std::uint64_t> offsets;
+        };
+
+        io m_mode;
+        std::vector<Shard> m_shards;
+        std::vector<Index> m_first;
+        Index m_records = 0;
+
+        void close() noexcept {
+            for(auto& shard: m_shards){
+                if(shard.map) ::munmap(const_cast<std::uint8_t*>(shard.map), shard.length);
+                if(shard.fd >= 0) ::close(shard.fd);
+            }
+            m_shards.clear();
+        }
+
+        void openShard(Shard& shard, const std::string& name){
+            struct stat st{};
+            if(::fstat(shard.fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < detail::record_header_size)
+                throw std::runtime_error("lazy: " + name + " is not a record shard");
+            shard.length = static_cast<std::size_t>(st.st_size);
+
+            char header[detail::record_header_size];
+            detail::pread_all(shard.fd, header, sizeof(header), 0);
+            std::uint64_t count, index;
+            std::memcpy(&count, header + 8, 8);
+            std::memcpy(&index, header + 16, 8);
+            if(std::memcmp(header, detail::record_magic, 4) != 0
+                    || index + (count + 1) * sizeof(std::uint64_t) > shard.length)
+                throw std::runtime_error("lazy: " + name + " is not a record shard");
+
+            shard.offsets.resize(count + 1);
+            detail::pread_all(shard.fd, shard.offsets.data(), shard.offsets.size() * sizeof(std::uint64_t), index);
+
+            // the records must lie in order between the header and the index
+            if(shard.offsets.front() < detail::record_header_size || shard.offsets.back() > index
+                    || !std::is_sorted(shard.offsets.begin(), shard.offsets.end()))
+                throw std::runtime_error("lazy: " + name + " has a corrupt record index");
+
+            if(m_mode == io::mmap){
+                void* addr = ::mmap(nullptr, shard.length, PROT_READ, MAP_SHARED, shard.fd, 0);
+                if(addr == MAP_FAILED)
+                    throw std::runtime_error("lazy: cannot map " + name);
+                shard.map = static_cast<const std::uint8_t*>(addr);
+                ::madvise(addr, shard.length, MADV_RANDOM);
+            }
+        }
+
+        std::pair<std::size_t, std::size_t> locate(Index i) const {
+            if(i < 0 || i >= m_records)
+                throw std::runtime_error("lazy: record out of range");
+            const auto it = std::upper_bound(m_first.begin(), m_first.end(), i) - 1;
+            const auto shard = static_cast<std::size_t>(it - m_first.begin());
+            return {shard, static_cast<std::size_t>(i - *it)};
+        }
+    };
+
+    /*
+     * ShuffledRecords : streams every record once per epoch in a shuffled order
+     *
+     * Workers read whole shards (in a shuffled shard order) with large sequential reads
+     * and put views of their records into a buffer of `capacity` records; next() copies
+     * a random record out of the buffer. The payload of a shard read with io::pread is
+     * shared by its views and freed with the last of them; with io::mmap the views point
+     * into the mapping. The order mixes records across shards within a window of `capacity` records.
+     */
+
+    class ShuffledRecords {
+    public:
+        explicit ShuffledRecords(const RecordReader& reader, std::size_t capacity = 8192, unsigned workers = 2)
+        : m_reader(reader), m_capacity(std::max<std::size_t>(1, capacity)),
+        m_low(m_capacity - std::max<std::size_t>(1, m_capacity / 8)),
+        m_workers(std::max(1u, workers)), m_gen(random::make_generator()) {
+
+        }
+
+        ShuffledRecords(const ShuffledRecords&) = delete;
+        ShuffledRecords& operator=(const ShuffledRecords&) = delete;
+
+        ~ShuffledRecords(){
+            stop();
+        }
+
+        void start_epoch(){
+            stop();
+
+            m_order.resize(static_cast<std::size_t>(m_reader.shards()));
+            std::iota(m_order.begin(), m_order.end(), Index(0));
+            std::shuffle(m_order.begin(), m_order.end(), m_gen);
+
+            m_buffer.clear();
+            m_next_shard = 0;
+            m_cancel = false;
+            m_active = m_workers;
+            for(unsigned i = 0; i < m_workers; ++i)
+                m_threads.emplace_back([this](){ produce(); });
+        }
+
+        // false at the end of the epoch
+        bool next(std::vector<std::uint8_t>& out){
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_has_data.wait(lock, [this](){
+                return m_buffer.size() > m_low || m_active == 0 || m_error;
+            });
+            if(m_error){
+                auto error = m_error;
+                m_error = nullptr;
+                std::rethrow_exception(error);
+            }
+            if(m_buffer.empty())
+                return false;
+
+            std::uniform_int_distribution<std::size_t> pick(0, m_buffer.size() - 1);
+            auto& chosen = m_buffer[pick(m_gen)];
+            Pending record = std::move(chosen);
+            chosen = std::move(m_buffer.back());
+            m_buffer.pop_back();
+
+            // the workers refill in blocks, not one record at a time
+            const bool refill = m_buffer.size() == m_low;
+            lock.unlock();
+            if(refill) m_has_space.notify_one();
+
+            out.assign(record.view.data, record.view.data + record.view.size);
+            return true;
+        }
+
+    private:
+        // a record in the buffer, and the payload of its shard (null with io::mmap)
+        struct Pending {
+            RecordView view;
+            std::shared_ptr<const std::vector<std::uint8_t>> payload;
+        };
+
+        const RecordReader& m_reader;
+        std::size_t m_capacity;
+        std::size_t m_low;          // next() waits for more than m_low records
+        unsigned m_workers;
+        random::Philox m_gen;
+
+        std::vector<Index> m_order;
+        std::vector<Pending> m_buffer;
+        std::size_t m_next_shard = 0;
+        unsigned m_active = 0;
+        bool m_cancel = false;
+        std::exception_ptr m_error;
+
+        std::mutex m_mutex;
+        std::condition_variable m_has_data;
+        std::condition_variable m_has_space;
+        std::vector<std::thread> m_threads;
+
+        void stop(){
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_cancel = true;
+            }
+            m_has_space.notify_all();
+            for(auto& t: m_threads) t.join();
+            m_threads.clear();
+        }
+
+        void produce(){
+            std::vector<RecordView> records;
+            for(;;){
+                Index shard;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if(m_cancel || m_next_shard >= m_order.size()) break;
+                    shard = m_order[m_next_shard++];
+                }
+
+                std::shared_ptr<std::vector<std::uint8_t>> payload;
+                try {
+                    payload = std::make_shared<std::vector<std::uint8_t>>();
+                    m_reader.readShard(shard, *payload, records);
+                } catch(...) {
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        m_error = std::current_exception();
+                    }
+                    m_has_data.notify_all();
+                    break;
+                }
+                if(payload->empty()) payload.reset();
+
+                // as many records as fit, under one lock
+                for(std::size_t k = 0; k < records.size(); ){
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_has_space.wait(lock, [this](){
+                        return m_buffer.size() < m_capacity || m_cancel;
+                    });
+                    if(m_cancel) break;
+                    while(k < records.size() && m_buffer.size() < m_capacity)
+                        m_buffer.push_back({records[k++], payload});
+                    lock.unlock();
+                    m_has_data.notify_one();
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_active;
+            }
+            m_has_data.notify_all();
+        }
+    };
+}
+
+#endif //LAZYDEEP1_RECORDFILE_HPP
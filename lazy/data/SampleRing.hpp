@@ -0,0 +1,189 @@
+#ifndef LAZYDEEP1_SAMPLERING_HPP
+#define LAZYDEEP1_SAMPLERING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include "../Operand.hpp"
+
+namespace lazy::data {
+
+    /*
+     * SampleRing : fixed-capacity single-producer / single-consumer ring of samples
+     *
+     * Samples are columns of two preallocated matrices (input_rows x capacity and
+     * label_rows x capacity), so the memory never grows with the length of the stream.
+     * The two ends only share two counters: push() and drop() never wait for each other.
+     * push() fails when the ring is full; the producer decides whether to retry or drop.
+     *
+     *   producer : ring.push(x, t) ... ring.close();
+     *   consumer : if(ring.size() >= n) { ring.peek(n, input, label); ring.drop(n); }
+     */
+
+    template<typename Input, typename Label = Input>
+    class SampleRing {
+    public:
+        SampleRing(Index capacity, Index input_rows, Index label_rows)
+        : m_capacity(static_cast<std::size_t>(capacity)),
+        m_input(input_rows, capacity), m_label(label_rows, capacity) {
+
+        }
+
+        // Anything about Copy/Move is inhibited
+        SampleRing(const SampleRing&) = delete;
+        SampleRing& operator=(const SampleRing&) = delete;
+        SampleRing(SampleRing&&) = delete;
+        SampleRing& operator=(SampleRing&&) = delete;
+
+        /*
+         * producer side
+         */
+
+        template<typename A, typename B>
+        bool push(const Eigen::MatrixBase<A>& input, const Eigen::MatrixBase<B>& label){
+            const std::size_t head = m_head.load(std::memory_order_relaxed);
+            if(head - m_tail.load(std::memory_order_acquire) >= m_capacity)
+                return false;
+
+            const auto slot = static_cast<Index>(head % m_capacity);
+            m_input.col(slot) = input;
+            m_label.col(slot) = label;
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // raw sample (input_rows input scalars, then label_rows label scalars)
+        bool push(const typename Input::Scalar* input, const typename Label::Scalar* label){
+            using InputMap = Eigen::Map<const Eigen::Matrix<typename Input::Scalar, Eigen::Dynamic, 1>>;
+            using LabelMap = Eigen::Map<const Eigen::Matrix<typename Label::Scalar, Eigen::Dynamic, 1>>;
+            return push(InputMap(input, m_input.rows()), LabelMap(label, m_label.rows()));
+        }
+
+        // no more samples will come
+        void close() noexcept {
+            m_closed.store(true, std::memory_order_release);
+        }
+
+        /*
+         * consumer side
+         */
+
+        bool closed() const noexcept {
+            return m_closed.load(std::memory_order_acquire);
+        }
+
+        Index size() const noexcept {
+            return static_cast<Index>(m_head.load(std::memory_order_acquire)
+                    - m_tail.load(std::memory_order_relaxed));
+        }
+
+        Index capacity() const noexcept {
+            return static_cast<Index>(m_capacity);
+        }
+
+        Index inputRows() const noexcept {
+            return m_input.rows();
+        }
+
+        Index labelRows() const noexcept {
+            return m_label.rows();
+        }
+
+        // the n oldest samples into the first n columns of input / label (n <= size())
+        void peek(Index n, Input& input, Label& label) const {
+            const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+            const auto first = static_cast<Index>(tail % m_capacity);
+            const Index run = std::min(n, capacity() - first);
+
+            // at most two contiguous pieces, around the end of the ring
+            input.leftCols(run) = m_input.middleCols(first, run);
+            label.leftCols(run) = m_label.middleCols(first, run);
+            if(run < n){
+                input.middleCols(run, n - run) = m_input.leftCols(n - run);
+                label.middleCols(run, n - run) = m_label.leftCols(n - run);
+            }
+        }
+
+        // releases the n oldest samples to the producer (n <= size())
+        void drop(Index n) noexcept {
+            m_tail.fetch_add(static_cast<std::size_t>(n), std::memory_order_release);
+        }
+
+    private:
+        std::size_t m_capacity;
+        Input m_input;
+        Label m_label;
+
+        // on separate cache lines: each is written by one side only
+        alignas(64) std::atomic<std::size_t> m_head{0};
+        alignas(64) std::atomic<std::size_t> m_tail{0};
+        alignas(64) std::atomic<bool> m_closed{false};
+    };
+
+    /*
+     * read_samples : pushes raw samples read from a file descriptor (a pipe, a socket, a file)
+     *
+     * Each sample is ring.inputRows() input scalars followed by ring.labelRows() label scalars,
+     * in native byte order. With follow, the end of a regular file is polled for new data (like tail -f)
+     * until stop is set; otherwise reading ends at the end of the stream.
+     * While the ring is full the reader waits for space, so no sample is lost.
+     * The ring is closed on return; the number of samples pushed is returned.
+     */
+
+    template<typename Input, typename Label>
+    Index read_samples(int fd, SampleRing<Input, Label>& ring, const std::atomic<bool>& stop, bool follow = false){
+        using InputScalar = typename Input::Scalar;
+        using LabelScalar = typename Label::Scalar;
+        const Index input_rows = ring.inputRows(), label_rows = ring.labelRows();
+        const std::size_t input_bytes = sizeof(InputScalar) * static_cast<std::size_t>(input_rows);
+        const std::size_t sample_bytes = input_bytes + sizeof(LabelScalar) * static_cast<std::size_t>(label_rows);
+
+        // one sample, copied out of the byte stream to keep the scalars aligned
+        std::vector<InputScalar> input(static_cast<std::size_t>(input_rows));
+        std::vector<LabelScalar> label(static_cast<std::size_t>(label_rows));
+        std::vector<char> buffer(std::max<std::size_t>(sample_bytes, 1 << 16));
+        std::size_t filled = 0;
+        Index pushed = 0;
+
+        while(!stop.load(std::memory_order_relaxed)){
+            const ssize_t r = ::read(fd, buffer.data() + filled, buffer.size() - filled);
+            if(r < 0 && errno == EINTR) continue;
+            if(r < 0) break;
+            if(r == 0){
+                if(!follow) break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            filled += static_cast<std::size_t>(r);
+
+            std::size_t used = 0;
+            for(; filled - used >= sample_bytes; used += sample_bytes){
+                std::memcpy(input.data(), buffer.data() + used, input_bytes);
+                std::memcpy(label.data(), buffer.data() + used + input_bytes, sample_bytes - input_bytes);
+                bool done = true;
+                while(!ring.push(input.data(), label.data())){
+                    if(stop.load(std::memory_order_relaxed)){
+                        done = false;
+                        break;
+                    }
+                    std::this_thread::yield();
+                }
+                if(!done) break;
+                ++pushed;
+            }
+            // a partial sample waits for the rest
+            std::memmove(buffer.data(), buffer.data() + used, filled - used);
+            filled -= used;
+        }
+
+        ring.close();
+        return pushed;
+    }
+}
+
+#endif //LAZYDEEP1_SAMPLERING_HPP
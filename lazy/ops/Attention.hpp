@@ -0,0 +1,285 @@
+#ifndef LAZYDEEP1_ATTENTION_HPP
+#define LAZYDEEP1_ATTENTION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include "Kernel.hpp"
+
+namespace lazy::nn {
+
+    namespace detail {
+
+        /*
+         * Scaled dot-product attention, tiled with an online softmax
+         *
+         * Per item and head, the queries are taken a tile at a time; every tile of keys gives
+         * S = scale * K^T Q (keys x queries, a column per query), and the softmax is folded
+         * into the running max m, the running sum l and the output accumulator O of each query:
+         *   m' = max(m, max S), P = exp(S - m'), l = l e^(m - m') + sum P, O = O e^(m - m') + V P
+         * so no score matrix larger than one tile exists. Only log(sum exp S) of every query
+         * is kept; the backward pass rebuilds P tile by tile from it:
+         *   dV += dO P^T, dP = V^T dO, dS = P (dP - sum(dO O)), dQ += scale K dS, dK += scale Q dS^T
+         * Items and heads run in parallel.
+         */
+
+        template<typename S>
+        struct Attention {
+            using MatrixType = Matrix<S>;
+            using ConstBlock = Eigen::Map<const MatrixType, 0, Eigen::OuterStride<>>;
+            using Block = Eigen::Map<MatrixType, 0, Eigen::OuterStride<>>;
+
+            static constexpr Index QueryTile = 64;
+            static constexpr Index KeyTile = 64;
+
+            // a score that never wins a max; exp of (masked - a real score) underflows to 0
+            static constexpr S masked() noexcept {
+                return std::numeric_limits<S>::lowest() / 2;
+            }
+
+            Index heads;
+            S scale;        // 0 : 1 / sqrt(head dimension)
+
+            struct Sizes {
+                Index d, dv, lq, lk, items;
+                Index dh, dvh;
+                S scale;
+            };
+
+            Sizes sizes(const Tensor<S>& q, const Tensor<S>& k, const Tensor<S>& v) const {
+                Sizes s{q.dim(0), v.dim(0), q.dim(1), k.dim(1), 0, 0, 0, scale};
+                s.items = q.size() / std::max<Index>(s.d * s.lq, 1);
+                if(k.dim(0) != s.d || v.dim(1) != s.lk || heads <= 0 || s.d % heads != 0 || s.dv % heads != 0
+                        || k.size() != s.d * s.lk * s.items || v.size() != s.dv * s.lk * s.items)
+                    throw std::runtime_error("lazy: attention shapes do not match");
+                s.dh = s.d / heads;
+                s.dvh = s.dv / heads;
+                if(s.scale == 0) s.scale = S(1) / std::sqrt(static_cast<S>(s.dh));
+                return s;
+            }
+
+            // mask (0 : masked) broadcast to {keys, queries, items}
+            static Tensor<S> maskView(const Tensor<S>* mask, const Sizes& s){
+                if(!mask) return Tensor<S>();
+                return mask->broadcast({s.lk, s.lq, s.items});
+            }
+
+            // scores of keys [k0, k0 + nk) x queries [q0, q0 + nq) of item n, masked
+            static void scores(const ConstBlock& q, const ConstBlock& k, const Tensor<S>& mask, const Sizes& s,
+                    Index n, Index q0, Index nq, Index k0, Index nk, MatrixType& out){
+                out.resize(nk, nq);
+                out.noalias() = s.scale * (k.middleCols(k0, nk).transpose() * q.middleCols(q0, nq));
+                if(mask.size() == 0) return;
+
+                const S* m = mask.data();
+                const Index s0 = mask.strides()[0], s1 = mask.strides()[1], s2 = mask.strides()[2];
+                for(Index c = 0; c < nq; ++c)
+                    for(Index r = 0; r < nk; ++r)
+                        if(m[(k0 + r) * s0 + (q0 + c) * s1 + n * s2] == S(0)) out(r, c) = masked();
+            }
+
+            void forward(const Tensor<S>& qt, const Tensor<S>& kt, const Tensor<S>& vt, const Tensor<S>* mask,
+                    Tensor<S>& out, std::vector<S>& lse) const {
+                const Sizes s = sizes(qt, kt, vt);
+                const Tensor<S> mk = maskView(mask, s);
+                lse.resize(static_cast<std::size_t>(s.lq * heads * s.items));
+                const S* q = qt.data();
+                const S* k = kt.data();
+                const S* v = vt.data();
+                S* o = out.data();
+
+                #pragma omp parallel for schedule(dynamic) if(s.items * heads > 1)
+                for(Index p = 0; p < s.items * heads; ++p){
+                    const Index n = p / heads, h = p % heads;
+                    const ConstBlock qh(q + n * s.d * s.lq + h * s.dh, s.dh, s.lq, Eigen::OuterStride<>(s.d));
+                    const ConstBlock kh(k + n * s.d * s.lk + h * s.dh, s.dh, s.lk, Eigen::OuterStride<>(s.d));
+                    const ConstBlock vh(v + n * s.dv * s.lk + h * s.dvh, s.dvh, s.lk, Eigen::OuterStride<>(s.dv));
+                    Block oh(o + n * s.dv * s.lq + h * s.dvh, s.dvh, s.lq, Eigen::OuterStride<>(s.dv));
+                    S* lse_h = lse.data() + p * s.lq;
+
+                    MatrixType sc, acc;
+                    std::vector<S> m, l;
+                    for(Index q0 = 0; q0 < s.lq; q0 += QueryTile){
+                        const Index nq = std::min(QueryTile, s.lq - q0);
+                        acc.setZero(s.dvh, nq);
+                        m.assign(static_cast<std::size_t>(nq), masked());
+                        l.assign(static_cast<std::size_t>(nq), S(0));
+
+                        for(Index k0 = 0; k0 < s.lk; k0 += KeyTile){
+                            const Index nk = std::min(KeyTile, s.lk - k0);
+                            scores(qh, kh, mk, s, n, q0, nq, k0, nk, sc);
+
+                            for(Index c = 0; c < nq; ++c){
+                                const S top = std::max(m[c], sc.col(c).maxCoeff());
+                                if(top == masked()){
+                                    // nothing unmasked yet
+                                    sc.col(c).setZero();
+                                    continue;
+                                }
+                                const S correction = std::exp(m[c] - top);
+                                sc.col(c) = (sc.col(c).array() - top).exp().matrix();
+                                l[c] = l[c] * correction + sc.col(c).sum();
+                                acc.col(c) *= correction;
+                                m[c] = top;
+                            }
+                            acc.noalias() += vh.middleCols(k0, nk) * sc;
+                        }
+
+                        for(Index c = 0; c < nq; ++c){
+                            if(l[c] > 0){
+                                oh.col(q0 + c) = acc.col(c) / l[c];
+                                lse_h[q0 + c] = m[c] + std::log(l[c]);
+                            } else {
+                                // every key is masked
+                                oh.col(q0 + c).setZero();
+                                lse_h[q0 + c] = masked();
+                            }
+                        }
+                    }
+                }
+            }
+
+            void backward(const Tensor<S>& qt, const Tensor<S>& kt, const Tensor<S>& vt, const Tensor<S>* mask,
+                    const Tensor<S>& ot, const Tensor<S>& dot, const std::vector<S>& lse,
+                    Tensor<S>* dq, Tensor<S>* dk, Tensor<S>* dv) const {
+                const Sizes s = sizes(qt, kt, vt);
+                const Tensor<S> mk = maskView(mask, s);
+
+                // every delta is written by the pass, dQ / dK / dV are needed for the others anyway
+                Tensor<S> gq = Tensor<S>::Zero(qt.shape()), gk = Tensor<S>::Zero(kt.shape()), gv = Tensor<S>::Zero(vt.shape());
+                const S* q = qt.data();
+                const S* k = kt.data();
+                const S* v = vt.data();
+                const S* o = ot.data();
+                const S* d = dot.data();
+                S* pq = gq.data();
+                S* pk = gk.data();
+                S* pv = gv.data();
+
+                #pragma omp parallel for schedule(dynamic) if(s.items * heads > 1)
+                for(Index p = 0; p < s.items * heads; ++p){
+                    const Index n = p / heads, h = p % heads;
+                    const ConstBlock qh(q + n * s.d * s.lq + h * s.dh, s.dh, s.lq, Eigen::OuterStride<>(s.d));
+                    const ConstBlock kh(k + n * s.d * s.lk + h * s.dh, s.dh, s.lk, Eigen::OuterStride<>(s.d));
+                    const ConstBlock vh(v + n * s.dv * s.lk + h * s.dvh, s.dvh, s.lk, Eigen::OuterStride<>(s.dv));
+                    const ConstBlock oh(o + n * s.dv * s.lq + h * s.dvh, s.dvh, s.lq, Eigen::OuterStride<>(s.dv));
+                    const ConstBlock doh(d + n * s.dv * s.lq + h * s.dvh, s.dvh, s.lq, Eigen::OuterStride<>(s.dv));
+                    Block dqh(pq + n * s.d * s.lq + h * s.dh, s.dh, s.lq, Eigen::OuterStride<>(s.d));
+                    Block dkh(pk + n * s.d * s.lk + h * s.dh, s.dh, s.lk, Eigen::OuterStride<>(s.d));
+                    Block dvh(pv + n * s.dv * s.lk + h * s.dvh, s.dvh, s.lk, Eigen::OuterStride<>(s.dv));
+                    const S* lse_h = lse.data() + p * s.lq;
+
+                    // sum(dO O) of every query
+                    const Matrix<S> delta = doh.cwiseProduct(oh).colwise().sum();
+
+                    MatrixType sc, dp;
+                    for(Index q0 = 0; q0 < s.lq; q0 += QueryTile){
+                        const Index nq = std::min(QueryTile, s.lq - q0);
+                        for(Index k0 = 0; k0 < s.lk; k0 += KeyTile){
+                            const Index nk = std::min(KeyTile, s.lk - k0);
+                            scores(qh, kh, mk, s, n, q0, nq, k0, nk, sc);
+
+                            // P from the scores and log(sum exp) (masked scores underflow to 0)
+                            for(Index c = 0; c < nq; ++c){
+                                if(lse_h[q0 + c] == masked()) sc.col(c).setZero();
+                                else sc.col(c) = (sc.col(c).array() - lse_h[q0 + c]).exp().matrix();
+                            }
+
+                            dvh.middleCols(k0, nk).noalias() += doh.middleCols(q0, nq) * sc.transpose();
+                            dp.noalias() = vh.middleCols(k0, nk).transpose() * doh.middleCols(q0, nq);
+                            for(Index c = 0; c < nq; ++c)
+                                sc.col(c).array() *= (dp.col(c).array() - delta(0, q0 + c)) * s.scale;
+
+                            dqh.middleCols(q0, nq).noalias() += kh.middleCols(k0, nk) * sc;
+                            dkh.middleCols(k0, nk).noalias() += qh.middleCols(q0, nq) * sc.transpose();
+                        }
+                    }
+                }
+
+                if(dq) *dq = std::move(gq);
+                if(dk) *dk = std::move(gk);
+                if(dv) *dv = std::move(gv);
+            }
+        };
+
+        template<typename S>
+        TensorShape attention_shape(const Tensor<S>& q, const Tensor<S>& v){
+            if(q.rank() < 2 || v.rank() < 2)
+                throw std::runtime_error("lazy: attention needs {features, length, ...} tensors");
+            TensorShape shape = q.shape();
+            shape[0] = v.dim(0);
+            return shape;
+        }
+    }
+
+    /*
+     * Multi-head scaled dot-product attention
+     * Q {d, queries, batch...}, K {d, keys, batch...}, V {dv, keys, batch...} -> {dv, queries, batch...}
+     * Head i reads rows [i d / heads, (i + 1) d / heads) of Q and K, and writes the same rows of
+     * the output from V; scale defaults to 1 / sqrt(d / heads).
+     * mask (optional) is broadcast to {keys, queries, batch}, and keys where it is 0 are ignored
+     * (e.g. {keys, queries} causal, {keys, 1, batch} padding); d(ret) / d(mask) is undefined.
+     * Memory is linear in the sequence length : one log(sum exp) per query is kept.
+     */
+
+    template<typename T1, typename T2, typename T3>
+    [[nodiscard]] decltype(auto) attention
+            (const T1 &q, const T2 &k, const T3 &v, Index heads = 1,
+             typename T1::element_type::ValueType::Scalar scale = 0){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        static_assert(is_tensor_v<ValueType>, "lazy: attention needs tensor operands");
+        using K = Kernel<ValueType, 3>;
+        const auto att = std::make_shared<const detail::Attention<ScalarType>>(detail::Attention<ScalarType>{heads, scale});
+        const auto lse = std::make_shared<std::vector<ScalarType>>();
+
+        K kernel;
+        kernel.shape = [](const typename K::Inputs& in) -> typename K::Shape {
+            return detail::attention_shape(*in[0], *in[2]);
+        };
+        kernel.forward = [att, lse](const typename K::Inputs& in, ValueType& out){
+            att->forward(in[0]->contiguous(), in[1]->contiguous(), in[2]->contiguous(), nullptr, out, *lse);
+        };
+        kernel.backward = [att, lse](const typename K::Inputs& in, const ValueType* out, const ValueType& dout,
+                const typename K::Deltas& din){
+            att->backward(in[0]->contiguous(), in[1]->contiguous(), in[2]->contiguous(), nullptr,
+                    out->contiguous(), dout.contiguous(), *lse, din[0], din[1], din[2]);
+        };
+        kernel.backward_reads_output = true;
+
+        return make_kernel_operand<ValueType, 3>(std::make_shared<const K>(std::move(kernel)),
+                {PtrType(q), PtrType(k), PtrType(v)});
+    }
+
+    // T4 an operand, not a head count
+    template<typename T1, typename T2, typename T3, typename T4, typename = typename T4::element_type>
+    [[nodiscard]] decltype(auto) attention
+            (const T1 &q, const T2 &k, const T3 &v, const T4 &mask, Index heads = 1,
+             typename T1::element_type::ValueType::Scalar scale = 0){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        static_assert(is_tensor_v<ValueType>, "lazy: attention needs tensor operands");
+        using K = Kernel<ValueType, 4>;
+        const auto att = std::make_shared<const detail::Attention<ScalarType>>(detail::Attention<ScalarType>{heads, scale});
+        const auto lse = std::make_shared<std::vector<ScalarType>>();
+
+        K kernel;
+        kernel.shape = [](const typename K::Inputs& in) -> typename K::Shape {
+            return detail::attention_shape(*in[0], *in[2]);
+        };
+        kernel.forward = [att, lse](const typename K::Inputs& in, ValueType& out){
+            att->forward(in[0]->contiguous(), in[1]->contiguous(), in[2]->contiguous(), in[3], out, *lse);
+        };
+        kernel.backward = [att, lse](const typename K::Inputs& in, const ValueType* out, const ValueType& dout,
+                const typename K::Deltas& din){
+            att->backward(in[0]->contiguous(), in[1]->contiguous(), in[2]->contiguous(), in[3],
+                    out->contiguous(), dout.contiguous(), *lse, din[0], din[1], din[2]);
+        };
+        kernel.backward_reads_output = true;
+
+        return make_kernel_operand<ValueType, 4>(std::make_shared<const K>(std::move(kernel)),
+                {PtrType(q), PtrType(k), PtrType(v), PtrType(mask)});
+    }
+}
+
+#endif //LAZYDEEP1_ATTENTION_HPP
@@ -0,0 +1,199 @@
+#ifndef LAZYDEEP1_BITMASK_HPP
+#define LAZYDEEP1_BITMASK_HPP
+
+#include <cstdint>
+#include <vector>
+#include "../Operand.hpp"
+#include "../random/Distribution.hpp"
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace lazy {
+
+    /*
+     * BitMask : one bit per element of a matrix (in storage order), packed into 64-bit words
+     *
+     * Backward passes that only need "was this element kept" (relu, dropout)
+     * hold a BitMask instead of a float matrix, 1/32 of the memory.
+     * Packing and expansion work on whole words with SIMD compares / masked moves.
+     */
+
+    class BitMask {
+    public:
+        using Word = std::uint64_t;
+        static constexpr Index WordBits = 64;
+
+        BitMask() = default;
+
+        void resize(Index size){
+            m_size = size;
+            m_words.resize(static_cast<std::size_t>((size + WordBits - 1) / WordBits));
+        }
+
+        Index size() const noexcept {
+            return m_size;
+        }
+
+        Index words() const noexcept {
+            return static_cast<Index>(m_words.size());
+        }
+
+        Word* data() noexcept {
+            return m_words.data();
+        }
+
+        const Word* data() const noexcept {
+            return m_words.data();
+        }
+
+        bool operator[](Index i) const noexcept {
+            return (m_words[i / WordBits] >> (i % WordBits)) & 1u;
+        }
+
+        // y = max(x, 0) and bit i = (x_i > 0), in one pass
+        template<typename S>
+        void relu(const S* x, S* y, Index size){
+            resize(size);
+            const Index full = size / WordBits;
+            for(Index w = 0; w < full; ++w)
+                m_words[w] = relu_word(x + w * WordBits, y + w * WordBits);
+            if(full < words()){
+                Word bits = 0;
+                for(Index i = full * WordBits, b = 0; i < size; ++i, ++b){
+                    const bool pos = x[i] > S(0);
+                    y[i] = pos ? x[i] : S(0);
+                    bits |= Word(pos) << b;
+                }
+                m_words[full] = bits;
+            }
+        }
+
+        // bit i = 1 with probability p
+        void bernoulli(Index size, double p, random::Philox& gen){
+            resize(size);
+            random::fill_bernoulli_bits(data(), size, p, gen);
+        }
+
+        // out_i = bit i ? scale * d_i : 0 (out may alias d)
+        template<typename S>
+        void select(const S* d, S* out, S scale = S(1)) const {
+            const Index full = m_size / WordBits;
+            for(Index w = 0; w < full; ++w)
+                select_word(m_words[w], d + w * WordBits, out + w * WordBits, scale);
+            if(full < words()){
+                const Word bits = m_words[full];
+                for(Index i = full * WordBits, b = 0; i < m_size; ++i, ++b)
+                    out[i] = (bits >> b) & 1u ? scale * d[i] : S(0);
+            }
+        }
+
+        template<typename T>
+        void relu(const T& x, T& y){
+            const auto& src = value_traits<T>::contiguous(x);
+            value_traits<T>::resize(y, value_traits<T>::shape(src));
+            relu(src.data(), y.data(), src.size());
+        }
+
+        template<typename T>
+        void select(const T& d, T& out, typename T::Scalar scale = 1) const {
+            const auto& src = value_traits<T>::contiguous(d);
+            value_traits<T>::resize(out, value_traits<T>::shape(src));
+            select(src.data(), out.data(), scale);
+        }
+
+    private:
+        Index m_size = 0;
+        std::vector<Word> m_words;
+
+        /*
+         * one word (64 elements)
+         */
+
+        template<typename S>
+        static Word relu_word(const S* x, S* y){
+            Word bits = 0;
+            for(Index b = 0; b < WordBits; ++b){
+                const bool pos = x[b] > S(0);
+                y[b] = pos ? x[b] : S(0);
+                bits |= Word(pos) << b;
+            }
+            return bits;
+        }
+
+        template<typename S>
+        static void select_word(Word bits, const S* d, S* out, S scale){
+            for(Index b = 0; b < WordBits; ++b)
+                out[b] = (bits >> b) & 1u ? scale * d[b] : S(0);
+        }
+
+#if defined(__AVX512F__)
+        static Word relu_word(const float* x, float* y){
+            const __m512 zero = _mm512_setzero_ps();
+            Word bits = 0;
+            for(int k = 0; k < 4; ++k){
+                const __m512 v = _mm512_loadu_ps(x + 16 * k);
+                const __mmask16 m = _mm512_cmp_ps_mask(v, zero, _CMP_GT_OQ);
+                _mm512_storeu_ps(y + 16 * k, _mm512_maskz_mov_ps(m, v));
+                bits |= Word(m) << (16 * k);
+            }
+            return bits;
+        }
+
+        static void select_word(Word bits, const float* d, float* out, float scale){
+            const __m512 s = _mm512_set1_ps(scale);
+            for(int k = 0; k < 4; ++k){
+                const __mmask16 m = static_cast<__mmask16>(bits >> (16 * k));
+                _mm512_storeu_ps(out + 16 * k, _mm512_maskz_mul_ps(m, _mm512_loadu_ps(d + 16 * k), s));
+            }
+        }
+
+        static Word relu_word(const double* x, double* y){
+            const __m512d zero = _mm512_setzero_pd();
+            Word bits = 0;
+            for(int k = 0; k < 8; ++k){
+                const __m512d v = _mm512_loadu_pd(x + 8 * k);
+                const __mmask8 m = _mm512_cmp_pd_mask(v, zero, _CMP_GT_OQ);
+                _mm512_storeu_pd(y + 8 * k, _mm512_maskz_mov_pd(m, v));
+                bits |= Word(m) << (8 * k);
+            }
+            return bits;
+        }
+
+        static void select_word(Word bits, const double* d, double* out, double scale){
+            const __m512d s = _mm512_set1_pd(scale);
+            for(int k = 0; k < 8; ++k){
+                const __mmask8 m = static_cast<__mmask8>(bits >> (8 * k));
+                _mm512_storeu_pd(out + 8 * k, _mm512_maskz_mul_pd(m, _mm512_loadu_pd(d + 8 * k), s));
+            }
+        }
+#elif defined(__AVX2__)
+        static Word relu_word(const float* x, float* y){
+            const __m256 zero = _mm256_setzero_ps();
+            Word bits = 0;
+            for(int k = 0; k < 8; ++k){
+                const __m256 v = _mm256_loadu_ps(x + 8 * k);
+                const __m256 m = _mm256_cmp_ps(v, zero, _CMP_GT_OQ);
+                _mm256_storeu_ps(y + 8 * k, _mm256_and_ps(v, m));
+                bits |= Word(_mm256_movemask_ps(m)) << (8 * k);
+            }
+            return bits;
+        }
+
+        static void select_word(Word bits, const float* d, float* out, float scale){
+            // lane j of the expanded mask is set when bit j of the byte is
+            const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+            const __m256 s = _mm256_set1_ps(scale);
+            for(int k = 0; k < 8; ++k){
+                const __m256i byte = _mm256_set1_epi32(static_cast<int>((bits >> (8 * k)) & 0xFFu));
+                const __m256i m = _mm256_cmpeq_epi32(_mm256_and_si256(byte, lane_bits), lane_bits);
+                const __m256 v = _mm256_mul_ps(_mm256_loadu_ps(d + 8 * k), s);
+                _mm256_storeu_ps(out + 8 * k, _mm256_and_ps(v, _mm256_castsi256_ps(m)));
+            }
+        }
+#endif
+    };
+}
+
+#endif //LAZYDEEP1_BITMASK_HPP
@@ -0,0 +1,522 @@
+#ifndef LAZYDEEP1_CONV_HPP
+#define LAZYDEEP1_CONV_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "Kernel.hpp"
+
+namespace lazy::nn {
+
+    /*
+     * Images : one image per column, channels x height x width values
+     * channels_first : (c, y, x) at (c * height + y) * width + x
+     * channels_last  : (c, y, x) at (y * width + x) * channels + c
+     */
+
+    enum class layout {
+        channels_first,
+        channels_last
+    };
+
+    struct ImageShape {
+        Index channels = 1;
+        Index height = 0;
+        Index width = 0;
+        layout format = layout::channels_first;
+
+        Index size() const noexcept {
+            return channels * height * width;
+        }
+    };
+
+    // square window; stride, padding and dilation are the same on both axes
+    struct Conv2dOptions {
+        explicit Conv2dOptions(Index kernel, Index stride = 1, Index padding = 0, Index dilation = 1)
+        : kernel_height(kernel), kernel_width(kernel), stride(stride), padding(padding), dilation(dilation) {
+
+        }
+
+        Index kernel_height, kernel_width;
+        Index stride, padding, dilation;
+    };
+
+    struct Pool2dOptions {
+        explicit Pool2dOptions(Index kernel, Index stride = 0, Index padding = 0)
+        : kernel_height(kernel), kernel_width(kernel), stride(stride > 0 ? stride : kernel), padding(padding) {
+
+        }
+
+        Index kernel_height, kernel_width;
+        Index stride, padding;
+    };
+
+    namespace detail {
+
+        /*
+         * Window geometry shared by convolution and pooling
+         */
+
+        struct Window {
+            ImageShape in;
+            Index kh, kw, stride, pad, dilation;
+            Index oh, ow;
+            Index cs, ys, xs;   // strides of channel, row and column in an image column
+
+            Window(const ImageShape& image, Index kh, Index kw, Index stride, Index pad, Index dilation)
+            : in(image), kh(kh), kw(kw), stride(stride), pad(pad), dilation(dilation),
+            oh((image.height + 2 * pad - dilation * (kh - 1) - 1) / stride + 1),
+            ow((image.width + 2 * pad - dilation * (kw - 1) - 1) / stride + 1) {
+                if(oh <= 0 || ow <= 0)
+                    throw std::runtime_error("lazy: the window is larger than the padded image");
+                const bool first = image.format == layout::channels_first;
+                cs = first ? image.height * image.width : 1;
+                ys = first ? image.width : image.width * image.channels;
+                xs = first ? 1 : image.channels;
+            }
+
+            Index positions() const noexcept {
+                return oh * ow;
+            }
+
+            ImageShape output(Index channels) const noexcept {
+                return {channels, oh, ow, in.format};
+            }
+
+            // output columns ox whose input column ox * stride + off is inside the image
+            void validColumns(Index off, Index& lo, Index& hi) const noexcept {
+                lo = off >= 0 ? 0 : (-off + stride - 1) / stride;
+                hi = in.width - 1 - off < 0 ? 0 : std::min(ow, (in.width - 1 - off) / stride + 1);
+                hi = std::max(lo, hi);
+            }
+        };
+
+        /*
+         * Convolution as GEMM on patches (im2col)
+         *
+         * The columns of W follow (c, ky, kx) for channels_first and (ky, kx, c) for channels_last.
+         * Patches are built for a block of output positions at a time, small enough to stay
+         * in L2, and multiplied by W with Eigen's GEMM:
+         *   channels_first : cols is positions x patch; every column (c, ky, kx) is a shifted
+         *                    copy of input rows, and out (positions x channels) = cols * W^T
+         *   channels_last  : cols is patch x positions; every column is whole pixels (all
+         *                    channels at once), and out (channels x positions) = W * cols
+         */
+
+        template<typename S>
+        struct Conv2d : Window {
+            Conv2d(const ImageShape& image, const Conv2dOptions& opt)
+            : Window(image, opt.kernel_height, opt.kernel_width, opt.stride, opt.padding, opt.dilation) {
+
+            }
+
+            using MatrixType = Matrix<S>;
+            using OutputBlock = Eigen::Map<MatrixType, 0, Eigen::OuterStride<>>;
+            using ConstOutputBlock = Eigen::Map<const MatrixType, 0, Eigen::OuterStride<>>;
+
+            bool first() const noexcept {
+                return in.format == layout::channels_first;
+            }
+
+            Index patch() const noexcept {
+                return in.channels * kh * kw;
+            }
+
+            // positions per block : patch x block values in about 256 KiB (whole output rows)
+            Index block() const noexcept {
+                const Index budget = (Index(256) << 10) / static_cast<Index>(sizeof(S)) / patch();
+                return std::min(oh, std::max<Index>(1, budget / ow)) * ow;
+            }
+
+            // patches of positions [p0, p0 + np) of one image, scaled (p0 and np are whole rows)
+            template<typename In>
+            void im2col(const In* image, Index p0, Index np, S* cols, S scale) const {
+                const Index C = in.channels, H = in.height, oy0 = p0 / ow, rows = np / ow;
+
+                if(first()){
+                    for(Index c = 0; c < C; ++c)
+                        for(Index ky = 0; ky < kh; ++ky)
+                            for(Index kx = 0; kx < kw; ++kx, cols += np){
+                                const Index off = kx * dilation - pad;
+                                Index lo, hi;
+                                validColumns(off, lo, hi);
+                                for(Index r = 0; r < rows; ++r){
+                                    S* dst = cols + r * ow;
+                                    const Index y = (oy0 + r) * stride - pad + ky * dilation;
+                                    if(y < 0 || y >= H){
+                                        std::fill(dst, dst + ow, S(0));
+                                        continue;
+                                    }
+                                    const In* src = image + c * cs + y * ys;
+                                    std::fill(dst, dst + lo, S(0));
+                                    if(stride == 1){
+                                        // contiguous: vectorizes
+                                        for(Index ox = lo; ox < hi; ++ox) dst[ox] = scale * static_cast<S>(src[ox + off]);
+                                    } else {
+                                        for(Index ox = lo; ox < hi; ++ox) dst[ox] = scale * static_cast<S>(src[ox * stride + off]);
+                                    }
+                                    std::fill(dst + hi, dst + ow, S(0));
+                                }
+                            }
+                } else {
+                    for(Index q = 0; q < np; ++q){
+                        const Index y0 = (oy0 + q / ow) * stride - pad, x0 = (q % ow) * stride - pad;
+                        for(Index ky = 0; ky < kh; ++ky)
+                            for(Index kx = 0; kx < kw; ++kx, cols += C){
+                                const Index y = y0 + ky * dilation, x = x0 + kx * dilation;
+                                if(y >= 0 && y < H && x >= 0 && x < in.width){
+                                    const In* px = image + y * ys + x * xs;
+                                    for(Index c = 0; c < C; ++c) cols[c] = scale * static_cast<S>(px[c]);
+                                } else {
+                                    std::fill(cols, cols + C, S(0));
+                                }
+                            }
+                    }
+                }
+            }
+
+            // adds patch deltas back onto the image delta (the transpose of im2col)
+            void col2im(const S* cols, Index p0, Index np, S* image) const {
+                const Index C = in.channels, H = in.height, oy0 = p0 / ow, rows = np / ow;
+
+                if(first()){
+                    for(Index c = 0; c < C; ++c)
+                        for(Index ky = 0; ky < kh; ++ky)
+                            for(Index kx = 0; kx < kw; ++kx, cols += np){
+                                const Index off = kx * dilation - pad;
+                                Index lo, hi;
+                                validColumns(off, lo, hi);
+                                for(Index r = 0; r < rows; ++r){
+                                    const Index y = (oy0 + r) * stride - pad + ky * dilation;
+                                    if(y < 0 || y >= H) continue;
+                                    const S* src = cols + r * ow;
+                                    S* dst = image + c * cs + y * ys;
+                                    if(stride == 1){
+                                        for(Index ox = lo; ox < hi; ++ox) dst[ox + off] += src[ox];
+                                    } else {
+                                        for(Index ox = lo; ox < hi; ++ox) dst[ox * stride + off] += src[ox];
+                                    }
+                                }
+                            }
+                } else {
+                    for(Index q = 0; q < np; ++q){
+                        const Index y0 = (oy0 + q / ow) * stride - pad, x0 = (q % ow) * stride - pad;
+                        for(Index ky = 0; ky < kh; ++ky)
+                            for(Index kx = 0; kx < kw; ++kx, cols += C){
+                                const Index y = y0 + ky * dilation, x = x0 + kx * dilation;
+                                if(y < 0 || y >= H || x < 0 || x >= in.width) continue;
+                                S* px = image + y * ys + x * xs;
+                                for(Index c = 0; c < C; ++c) px[c] += cols[c];
+                            }
+                    }
+                }
+            }
+
+            // output positions [p0, p0 + np) of image n : positions x channels or channels x positions
+            template<typename M, typename Block = std::conditional_t<std::is_const_v<M>, ConstOutputBlock, OutputBlock>>
+            Block outputBlock(M& out, Index n, Index channels, Index p0, Index np) const {
+                auto* base = out.col(n).data();
+                return first()
+                        ? Block(base + p0, np, channels, Eigen::OuterStride<>(positions()))
+                        : Block(base + p0 * channels, channels, np, Eigen::OuterStride<>(channels));
+            }
+
+            template<typename In>
+            void forward(const In* x, Index samples, const MatrixType& w, S scale, MatrixType& out) const {
+                const Index rows = in.size(), oc = w.rows(), bs = block();
+                #pragma omp parallel if(samples > 1)
+                {
+                    MatrixType cols = first() ? MatrixType(bs, patch()) : MatrixType(patch(), bs);
+                    #pragma omp for schedule(static)
+                    for(Index n = 0; n < samples; ++n){
+                        for(Index p0 = 0; p0 < positions(); p0 += bs){
+                            const Index np = std::min(bs, positions() - p0);
+                            im2col(x + n * rows, p0, np, cols.data(), scale);
+                            auto o = outputBlock(out, n, oc, p0, np);
+                            if(first()){
+                                o.noalias() = Eigen::Map<const MatrixType>(cols.data(), np, patch()) * w.transpose();
+                            } else {
+                                o.noalias() = w * cols.leftCols(np);
+                            }
+                        }
+                    }
+                }
+            }
+
+            // dw = d / dW (if dw), dx = d / dx (if dx)
+            template<typename In>
+            void backward(const In* x, Index samples, const MatrixType& w, S scale, const MatrixType& dout,
+                    MatrixType* dw, MatrixType* dx) const {
+                const Index rows = in.size(), oc = w.rows(), bs = block();
+                if(dw) dw->setZero(oc, patch());
+                if(dx) dx->setZero(rows, samples);
+
+                #pragma omp parallel if(samples > 1)
+                {
+                    MatrixType cols = first() ? MatrixType(bs, patch()) : MatrixType(patch(), bs);
+                    MatrixType dcols(cols.rows(), cols.cols());
+                    MatrixType local = dw ? MatrixType::Zero(oc, patch()) : MatrixType();
+                    #pragma omp for schedule(static)
+                    for(Index n = 0; n < samples; ++n){
+                        for(Index p0 = 0; p0 < positions(); p0 += bs){
+                            const Index np = std::min(bs, positions() - p0);
+                            const auto d = outputBlock(dout, n, oc, p0, np);
+
+                            if(first()){
+                                Eigen::Map<MatrixType> c(cols.data(), np, patch()), dc(dcols.data(), np, patch());
+                                if(dw){
+                                    im2col(x + n * rows, p0, np, c.data(), scale);
+                                    local.noalias() += d.transpose() * c;
+                                }
+                                if(dx){
+                                    dc.noalias() = d * w;
+                                    col2im(dc.data(), p0, np, dx->col(n).data());
+                                }
+                            } else {
+                                if(dw){
+                                    im2col(x + n * rows, p0, np, cols.data(), scale);
+                                    local.noalias() += d * cols.leftCols(np).transpose();
+                                }
+                                if(dx){
+                                    dcols.leftCols(np).noalias() = w.transpose() * d;
+                                    col2im(dcols.data(), p0, np, dx->col(n).data());
+                                }
+                            }
+                        }
+                    }
+                    if(dw){
+                        #pragma omp critical
+                        *dw += local;
+                    }
+                }
+            }
+        };
+
+        /*
+         * Pooling windows of every output, per channel
+         * f(o, y_begin, y_end, x_begin, x_end, base) : output row o, clamped window, channel base offset
+         */
+
+        template<typename F>
+        void each_pool_window(const Window& win, F&& f){
+            const Index C = win.in.channels, H = win.in.height, W = win.in.width, pos = win.positions();
+            const bool first = win.in.format == layout::channels_first;
+            for(Index c = 0; c < C; ++c)
+                for(Index oy = 0; oy < win.oh; ++oy){
+                    const Index y0 = oy * win.stride - win.pad;
+                    const Index yb = std::max<Index>(y0, 0), ye = std::min(y0 + win.kh, H);
+                    for(Index ox = 0; ox < win.ow; ++ox){
+                        const Index x0 = ox * win.stride - win.pad;
+                        const Index xb = std::max<Index>(x0, 0), xe = std::min(x0 + win.kw, W);
+                        const Index p = oy * win.ow + ox;
+                        f(first ? c * pos + p : p * C + c, yb, ye, xb, xe, c * win.cs);
+                    }
+                }
+        }
+    }
+
+    /*
+     * Convolution
+     * x : images (ImageShape per column), W : out_channels x (channels * kernel_height * kernel_width)
+     * -> out_channels x out_height x out_width per column, in the layout of x
+     */
+
+    inline ImageShape conv2d_shape(const ImageShape& image, const Conv2dOptions& opt, Index out_channels){
+        return detail::Window(image, opt.kernel_height, opt.kernel_width, opt.stride, opt.padding, opt.dilation)
+                .output(out_channels);
+    }
+
+    template<typename T1, typename T2>
+    [[nodiscard]] decltype(auto) conv2d
+            (const T1 &t, const T2 &w, const ImageShape& image, const Conv2dOptions& opt){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        using K = Kernel<ValueType, 2>;
+        const auto conv = std::make_shared<const detail::Conv2d<ScalarType>>(image, opt);
+
+        K kernel;
+        kernel.shape = [conv](const typename K::Inputs& in) -> typename K::Shape {
+            if(in[1]->cols() != conv->patch() || in[0]->rows() != conv->in.size())
+                throw std::runtime_error("lazy: conv2d shapes do not match");
+            return {in[1]->rows() * conv->positions(), in[0]->cols()};
+        };
+        kernel.forward = [conv](const typename K::Inputs& in, ValueType& out){
+            conv->forward(in[0]->data(), in[0]->cols(), *in[1], ScalarType(1), out);
+        };
+        kernel.backward = [conv](const typename K::Inputs& in, const ValueType*, const ValueType& dout,
+                const typename K::Deltas& din){
+            conv->backward(in[0]->data(), in[0]->cols(), *in[1], ScalarType(1), dout, din[1], din[0]);
+        };
+
+        return make_kernel_operand<ValueType, 2>(std::make_shared<const K>(std::move(kernel)), {PtrType(t), PtrType(w)});
+    }
+
+    /*
+     * Convolution of raw integer images (e.g. uint8 pixels), scaled while the patches are built
+     * x is not in the graph of W and gets no delta (as in dot_product(W, x, scale))
+     */
+
+    template<typename T1, typename T2,
+            typename = std::enable_if_t<std::is_integral_v<typename T1::element_type::ValueType::Scalar>>>
+    [[nodiscard]] decltype(auto) conv2d
+            (const T1 &t, const T2 &w, const ImageShape& image, const Conv2dOptions& opt,
+             typename T2::element_type::ValueType::Scalar scale){
+        LAZY_TYPEDEF_OPERATOR(T2);
+        using K = Kernel<ValueType, 1>;
+        const auto conv = std::make_shared<const detail::Conv2d<ScalarType>>(image, opt);
+        const auto x = typename T1::element_type::Pointer(t);
+
+        K kernel;
+        kernel.shape = [conv, x](const typename K::Inputs& in) -> typename K::Shape {
+            const auto& img = x->eval();
+            if(in[0]->cols() != conv->patch() || img.rows() != conv->in.size())
+                throw std::runtime_error("lazy: conv2d shapes do not match");
+            return {in[0]->rows() * conv->positions(), img.cols()};
+        };
+        kernel.forward = [conv, x, scale](const typename K::Inputs& in, ValueType& out){
+            const auto& img = x->eval();
+            conv->forward(img.data(), img.cols(), *in[0], scale, out);
+        };
+        kernel.backward = [conv, x, scale](const typename K::Inputs& in, const ValueType*, const ValueType& dout,
+                const typename K::Deltas& din){
+            const auto& img = x->eval();
+            conv->backward(img.data(), img.cols(), *in[0], scale, dout, din[0], nullptr);
+        };
+
+        auto ret = make_kernel_operand<ValueType, 1>(std::make_shared<const K>(std::move(kernel)), {PtrType(w)});
+        link_operand(x, PtrType(ret));
+        return ret;
+    }
+
+    /*
+     * Pooling
+     * the padding never wins a max and counts as zeros in an average;
+     * it must be smaller than the kernel, so that every window holds a pixel of the image
+     */
+
+    namespace detail {
+
+        inline Window pool_window(const ImageShape& image, const Pool2dOptions& opt){
+            if(opt.padding < 0 || opt.padding >= opt.kernel_height || opt.padding >= opt.kernel_width)
+                throw std::runtime_error("lazy: pooling padding must be smaller than the kernel");
+            return Window(image, opt.kernel_height, opt.kernel_width, opt.stride, opt.padding, 1);
+        }
+    }
+
+    inline ImageShape pool2d_shape(const ImageShape& image, const Pool2dOptions& opt){
+        return detail::pool_window(image, opt).output(image.channels);
+    }
+
+    template<typename T>
+    [[nodiscard]] decltype(auto) max_pool2d
+            (const T &t, const ImageShape& image, const Pool2dOptions& opt){
+        LAZY_TYPEDEF_OPERATOR(T);
+        using K = Kernel<ValueType, 1>;
+        const auto win = std::make_shared<const detail::Window>(detail::pool_window(image, opt));
+
+        // position of the max of every output, within its image column, for the backward pass
+        const auto argmax = std::make_shared<std::vector<std::int32_t>>();
+
+        K kernel;
+        kernel.shape = [win](const typename K::Inputs& in) -> typename K::Shape {
+            return {win->in.channels * win->positions(), in[0]->cols()};
+        };
+        kernel.forward = [win, argmax](const typename K::Inputs& in, ValueType& out){
+            const auto& x = *in[0];
+            const Index samples = x.cols(), outputs = out.rows(), ys = win->ys, xs = win->xs;
+            argmax->resize(static_cast<std::size_t>(out.size()));
+
+            #pragma omp parallel for schedule(static) if(samples > 1)
+            for(Index n = 0; n < samples; ++n){
+                const ScalarType* img = x.col(n).data();
+                ScalarType* dst = out.col(n).data();
+                std::int32_t* arg = argmax->data() + n * outputs;
+                detail::each_pool_window(*win, [&](Index o, Index yb, Index ye, Index xb, Index xe, Index base){
+                    Index where = base + yb * ys + xb * xs;
+                    ScalarType best = img[where];
+                    for(Index y = yb; y < ye; ++y)
+                        for(Index xx = xb; xx < xe; ++xx){
+                            const Index k = base + y * ys + xx * xs;
+                            if(img[k] > best){
+                                best = img[k];
+                                where = k;
+                            }
+                        }
+                    dst[o] = best;
+                    arg[o] = static_cast<std::int32_t>(where);
+                });
+            }
+        };
+        kernel.backward = [win, argmax](const typename K::Inputs&, const ValueType*, const ValueType& dout,
+                const typename K::Deltas& din){
+            if(!din[0]) return;
+            auto& dx = *din[0];
+            dx.setZero(win->in.size(), dout.cols());
+            const Index outputs = dout.rows();
+            for(Index n = 0; n < dout.cols(); ++n){
+                const std::int32_t* arg = argmax->data() + n * outputs;
+                const ScalarType* d = dout.col(n).data();
+                ScalarType* dst = dx.col(n).data();
+                for(Index o = 0; o < outputs; ++o) dst[arg[o]] += d[o];
+            }
+        };
+        kernel.backward_reads_inputs = false;
+
+        return make_kernel_operand<ValueType, 1>(std::make_shared<const K>(std::move(kernel)), {PtrType(t)});
+    }
+
+    template<typename T>
+    [[nodiscard]] decltype(auto) avg_pool2d
+            (const T &t, const ImageShape& image, const Pool2dOptions& opt){
+        LAZY_TYPEDEF_OPERATOR(T);
+        using K = Kernel<ValueType, 1>;
+        const auto win = std::make_shared<const detail::Window>(detail::pool_window(image, opt));
+
+        K kernel;
+        kernel.shape = [win](const typename K::Inputs& in) -> typename K::Shape {
+            return {win->in.channels * win->positions(), in[0]->cols()};
+        };
+        kernel.forward = [win](const typename K::Inputs& in, ValueType& out){
+            const auto& x = *in[0];
+            const Index samples = x.cols(), ys = win->ys, xs = win->xs;
+            const ScalarType inv = ScalarType(1) / static_cast<ScalarType>(win->kh * win->kw);
+
+            #pragma omp parallel for schedule(static) if(samples > 1)
+            for(Index n = 0; n < samples; ++n){
+                const ScalarType* img = x.col(n).data();
+                ScalarType* dst = out.col(n).data();
+                detail::each_pool_window(*win, [&](Index o, Index yb, Index ye, Index xb, Index xe, Index base){
+                    ScalarType sum = 0;
+                    for(Index y = yb; y < ye; ++y)
+                        for(Index xx = xb; xx < xe; ++xx) sum += img[base + y * ys + xx * xs];
+                    dst[o] = sum * inv;
+                });
+            }
+        };
+        kernel.backward = [win](const typename K::Inputs&, const ValueType*, const ValueType& dout,
+                const typename K::Deltas& din){
+            if(!din[0]) return;
+            auto& dx = *din[0];
+            const Index samples = dout.cols(), ys = win->ys, xs = win->xs;
+            const ScalarType inv = ScalarType(1) / static_cast<ScalarType>(win->kh * win->kw);
+            dx.setZero(win->in.size(), samples);
+
+            #pragma omp parallel for schedule(static) if(samples > 1)
+            for(Index n = 0; n < samples; ++n){
+                const ScalarType* d = dout.col(n).data();
+                ScalarType* dst = dx.col(n).data();
+                detail::each_pool_window(*win, [&](Index o, Index yb, Index ye, Index xb, Index xe, Index base){
+                    const ScalarType g = d[o] * inv;
+                    for(Index y = yb; y < ye; ++y)
+                        for(Index xx = xb; xx < xe; ++xx) dst[base + y * ys + xx * xs] += g;
+                });
+            }
+        };
+        kernel.backward_reads_inputs = false;
+
+        return make_kernel_operand<ValueType, 1>(std::make_shared<const K>(std::move(kernel)), {PtrType(t)});
+    }
+}
+
+#endif //LAZYDEEP1_CONV_HPP
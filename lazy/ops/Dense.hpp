@@ -0,0 +1,153 @@
+#ifndef LAZYDEEP1_DENSE_HPP
+#define LAZYDEEP1_DENSE_HPP
+
+#include <algorithm>
+#include <stdexcept>
+#include "Kernel.hpp"
+#include "Functor.hpp"
+
+namespace lazy::nn {
+
+    enum class activation {
+        identity,
+        relu,
+        sigmoid,
+        tanh,
+        softsign
+    };
+
+    namespace detail {
+
+        /*
+         * Dense layer on column tiles
+         *
+         * The batch is cut into tiles of whole columns, small enough that a tile of the output
+         * stays in L2. Each tile is one GEMM whose output gets its bias and activation right away.
+         * The backward pass builds the tile of d/dz = dout * f'(y) once, while dout and y are
+         * in cache, and takes dx from it; dW and db are taken from the whole of d/dz at the end,
+         * so dW is one GEMM over the batch rather than a sum of small ones.
+         * Tiles run in parallel when there are several.
+         */
+
+        template<typename S>
+        struct Dense {
+            using MatrixType = Matrix<S>;
+
+            activation f;
+
+            // columns per tile : outputs x tile values in about 256 KiB
+            static Index tile(Index outputs) noexcept {
+                const Index budget = (Index(256) << 10) / static_cast<Index>(sizeof(S)) / std::max<Index>(outputs, 1);
+                return std::max<Index>(16, budget);
+            }
+
+            // runs g with the element-wise functor of f and of its derivative (in terms of the output)
+            template<typename G>
+            void dispatch(G&& g) const {
+                switch(f){
+                    case activation::relu:
+                        g(functor::relu_op<S>(), functor::relu_derivative_op<S>()); break;
+                    case activation::sigmoid:
+                        g(functor::sigmoid_op<S>(), functor::sigmoid_derivative_op<S>()); break;
+                    case activation::tanh:
+                        g(functor::tanh_op<S>(), functor::tanh_derivative_op<S>()); break;
+                    case activation::softsign:
+                        g(functor::softsign_op<S>(), functor::softsign_derivative_op<S>()); break;
+                    default:
+                        break;
+                }
+            }
+
+            void forward(const MatrixType& x, const MatrixType& w, const MatrixType& b, MatrixType& out) const {
+                const Index cols = x.cols(), step = tile(w.rows());
+                #pragma omp parallel for schedule(static) if(cols > step)
+                for(Index j = 0; j < cols; j += step){
+                    const Index nb = std::min(step, cols - j);
+                    auto o = out.middleCols(j, nb);
+                    o.noalias() = w * x.middleCols(j, nb);
+
+                    // column by column, while the tile is in cache
+                    if(f == activation::identity){
+                        for(Index c = 0; c < nb; ++c) o.col(c) += b.col(0);
+                    } else {
+                        dispatch([&](const auto& op, const auto&){
+                            for(Index c = 0; c < nb; ++c) o.col(c) = (o.col(c) + b.col(0)).unaryExpr(op);
+                        });
+                    }
+                }
+            }
+
+            // dx, dw, db are nullptr when not needed; dz holds d/dz between calls (unused for identity)
+            void backward(const MatrixType& x, const MatrixType& w, const MatrixType* y, const MatrixType& dout,
+                    MatrixType& dz, MatrixType* dx, MatrixType* dw, MatrixType* db) const {
+                const Index cols = dout.cols(), step = tile(w.rows());
+                if(dx) dx->resize(w.cols(), cols);
+
+                if(f != activation::identity){
+                    dz.resize(dout.rows(), cols);
+                    #pragma omp parallel for schedule(static) if(cols > step)
+                    for(Index j = 0; j < cols; j += step){
+                        const Index nb = std::min(step, cols - j);
+                        auto d = dz.middleCols(j, nb);
+                        dispatch([&](const auto&, const auto& derivative){
+                            d = dout.middleCols(j, nb).cwiseProduct(y->middleCols(j, nb).unaryExpr(derivative));
+                        });
+                        if(dx) dx->middleCols(j, nb).noalias() = w.transpose() * d;
+                    }
+                } else if(dx) {
+                    dx->noalias() = w.transpose() * dout;
+                }
+
+                const MatrixType& d = f == activation::identity ? dout : dz;
+                if(dw) dw->noalias() = d * x.transpose();
+                if(db){
+                    // column by column : rowwise().sum() walks rows across a column-major matrix
+                    db->setZero(d.rows(), 1);
+                    for(Index c = 0; c < cols; ++c) *db += d.col(c);
+                }
+            }
+        };
+    }
+
+    /*
+     * Dense layer : f(W * x + b) as one operator
+     * x : inputs x batch, W : outputs x inputs, b : outputs x 1 -> outputs x batch
+     * Equivalent to f(colwise_plus(dot_product(W, x), b)) without the two intermediate matrices,
+     * and with dx, dW and db computed in one backward pass.
+     */
+
+    template<typename T1, typename T2, typename T3>
+    [[nodiscard]] decltype(auto) dense
+            (const T1 &t, const T2 &w, const T3 &b, activation f = activation::identity){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        using K = Kernel<ValueType, 3>;
+        const auto layer = std::make_shared<const detail::Dense<ScalarType>>(detail::Dense<ScalarType>{f});
+
+        // d/dz of the last backward pass, kept to reuse its storage
+        const auto dz = std::make_shared<ValueType>();
+
+        K kernel;
+        kernel.shape = [](const typename K::Inputs& in) -> typename K::Shape {
+            const auto& x = *in[0];
+            const auto& w = *in[1];
+            const auto& b = *in[2];
+            if(w.cols() != x.rows() || b.rows() != w.rows() || b.cols() != 1)
+                throw std::runtime_error("lazy: dense shapes do not match");
+            return {w.rows(), x.cols()};
+        };
+        kernel.forward = [layer](const typename K::Inputs& in, ValueType& out){
+            layer->forward(*in[0], *in[1], *in[2], out);
+        };
+        kernel.backward = [layer, dz](const typename K::Inputs& in, const ValueType* out, const ValueType& dout,
+                const typename K::Deltas& din){
+            layer->backward(*in[0], *in[1], out, dout, *dz, din[0], din[1], din[2]);
+        };
+        // f'(z) is computed from the output
+        kernel.backward_reads_output = f != activation::identity;
+
+        return make_kernel_operand<ValueType, 3>(std::make_shared<const K>(std::move(kernel)),
+                {PtrType(t), PtrType(w), PtrType(b)});
+    }
+}
+
+#endif //LAZYDEEP1_DENSE_HPP
@@ -0,0 +1,192 @@
+#ifndef LAZYDEEP1_DUAL_HPP
+#define LAZYDEEP1_DUAL_HPP
+
+#include <cmath>
+#include <type_traits>
+#include <utility>
+
+namespace lazy {
+
+    /*
+     * Dual number a + b*e (e^2 = 0) for forward-mode differentiation
+     * Evaluating f(Dual(x, 1)) gives f(x) in value and f'(x) in slope.
+     * It is a plain pair of scalars with inline arithmetic only,
+     * so loops over it vectorize like loops over the scalar itself.
+     */
+
+    template<typename S>
+    struct Dual {
+        using Scalar = S;
+
+        S value;
+        S slope;
+
+        constexpr Dual(S v = S(0), S s = S(0)) noexcept : value(v), slope(s) {}
+
+        constexpr Dual& operator+=(const Dual& rhs) noexcept {
+            value += rhs.value; slope += rhs.slope;
+            return *this;
+        }
+        constexpr Dual& operator-=(const Dual& rhs) noexcept {
+            value -= rhs.value; slope -= rhs.slope;
+            return *this;
+        }
+        constexpr Dual& operator*=(const Dual& rhs) noexcept {
+            slope = slope * rhs.value + value * rhs.slope;
+            value *= rhs.value;
+            return *this;
+        }
+        constexpr Dual& operator/=(const Dual& rhs) noexcept {
+            const S inv = S(1) / rhs.value;
+            value *= inv;
+            slope = (slope - value * rhs.slope) * inv;
+            return *this;
+        }
+    };
+
+    /*
+     * arithmetic
+     */
+
+    template<typename S>
+    constexpr Dual<S> operator+(const Dual<S>& a) noexcept { return a; }
+    template<typename S>
+    constexpr Dual<S> operator-(const Dual<S>& a) noexcept { return {-a.value, -a.slope}; }
+
+    template<typename S>
+    constexpr Dual<S> operator+(Dual<S> a, const Dual<S>& b) noexcept { return a += b; }
+    template<typename S>
+    constexpr Dual<S> operator-(Dual<S> a, const Dual<S>& b) noexcept { return a -= b; }
+    template<typename S>
+    constexpr Dual<S> operator*(Dual<S> a, const Dual<S>& b) noexcept { return a *= b; }
+    template<typename S>
+    constexpr Dual<S> operator/(Dual<S> a, const Dual<S>& b) noexcept { return a /= b; }
+
+    // mixed with plain scalars (any arithmetic type, e.g. literals like 1 or 0.5)
+#define LAZY_DUAL_SCALAR_OPERATOR(OP) \
+    template<typename S, typename U, typename = std::enable_if_t<std::is_arithmetic_v<U>>> \
+    constexpr Dual<S> operator OP(const Dual<S>& a, U b) noexcept { return a OP Dual<S>(S(b)); } \
+    template<typename S, typename U, typename = std::enable_if_t<std::is_arithmetic_v<U>>> \
+    constexpr Dual<S> operator OP(U a, const Dual<S>& b) noexcept { return Dual<S>(S(a)) OP b; }
+
+    LAZY_DUAL_SCALAR_OPERATOR(+)
+    LAZY_DUAL_SCALAR_OPERATOR(-)
+    LAZY_DUAL_SCALAR_OPERATOR(*)
+    LAZY_DUAL_SCALAR_OPERATOR(/)
+
+#undef LAZY_DUAL_SCALAR_OPERATOR
+
+    /*
+     * comparison (on values, so that branches like relu work)
+     */
+
+#define LAZY_DUAL_COMPARISON(OP) \
+    template<typename S> \
+    constexpr bool operator OP(const Dual<S>& a, const Dual<S>& b) noexcept { return a.value OP b.value; } \
+    template<typename S, typename U, typename = std::enable_if_t<std::is_arithmetic_v<U>>> \
+    constexpr bool operator OP(const Dual<S>& a, U b) noexcept { return a.value OP S(b); } \
+    template<typename S, typename U, typename = std::enable_if_t<std::is_arithmetic_v<U>>> \
+    constexpr bool operator OP(U a, const Dual<S>& b) noexcept { return S(a) OP b.value; }
+
+    LAZY_DUAL_COMPARISON(<)
+    LAZY_DUAL_COMPARISON(>)
+    LAZY_DUAL_COMPARISON(<=)
+    LAZY_DUAL_COMPARISON(>=)
+    LAZY_DUAL_COMPARISON(==)
+    LAZY_DUAL_COMPARISON(!=)
+
+#undef LAZY_DUAL_COMPARISON
+
+    /*
+     * elementary functions (found by ADL for Dual arguments)
+     */
+
+    template<typename S>
+    inline Dual<S> abs(const Dual<S>& a){
+        return a.value < 0 ? -a : a;
+    }
+
+    template<typename S>
+    inline Dual<S> sqrt(const Dual<S>& a){
+        const S v = std::sqrt(a.value);
+        return {v, a.slope / (2 * v)};
+    }
+
+    template<typename S>
+    inline Dual<S> exp(const Dual<S>& a){
+        const S v = std::exp(a.value);
+        return {v, a.slope * v};
+    }
+
+    template<typename S>
+    inline Dual<S> log(const Dual<S>& a){
+        return {std::log(a.value), a.slope / a.value};
+    }
+
+    template<typename S, typename U, typename = std::enable_if_t<std::is_arithmetic_v<U>>>
+    inline Dual<S> pow(const Dual<S>& a, U ex){
+        const S e = S(ex);
+        if(e == 0)
+            return {S(1), S(0)};
+        return {std::pow(a.value, e), a.slope * e * std::pow(a.value, e - 1)};
+    }
+
+    template<typename S>
+    inline Dual<S> pow(const Dual<S>& a, const Dual<S>& b){
+        return exp(b * log(a));
+    }
+
+    template<typename S>
+    inline Dual<S> sin(const Dual<S>& a){
+        return {std::sin(a.value), a.slope * std::cos(a.value)};
+    }
+
+    template<typename S>
+    inline Dual<S> cos(const Dual<S>& a){
+        return {std::cos(a.value), -a.slope * std::sin(a.value)};
+    }
+
+    template<typename S>
+    inline Dual<S> tanh(const Dual<S>& a){
+        const S v = std::tanh(a.value);
+        return {v, a.slope * (1 - v * v)};
+    }
+
+    template<typename S>
+    inline Dual<S> sinh(const Dual<S>& a){
+        return {std::sinh(a.value), a.slope * std::cosh(a.value)};
+    }
+
+    template<typename S>
+    inline Dual<S> cosh(const Dual<S>& a){
+        return {std::cosh(a.value), a.slope * std::sinh(a.value)};
+    }
+
+    template<typename S>
+    inline Dual<S> max(const Dual<S>& a, const Dual<S>& b){
+        return a.value < b.value ? b : a;
+    }
+
+    template<typename S>
+    inline Dual<S> min(const Dual<S>& a, const Dual<S>& b){
+        return b.value < a.value ? b : a;
+    }
+
+    /*
+     * DualFunction : a function marked to be differentiated with Dual
+     * unaryExpr(t, differentiable(func)) calls func with Dual<Scalar> only, so func has to be
+     * written for it (a generic lambda over the functions above); nothing is probed.
+     */
+
+    template<typename F>
+    struct DualFunction {
+        F func;
+    };
+
+    template<typename F>
+    DualFunction<F> differentiable(F func){
+        return {std::move(func)};
+    }
+}
+
+#endif //LAZYDEEP1_DUAL_HPP
@@ -0,0 +1,101 @@
+#ifndef LAZYDEEP1_EMBEDDING_HPP
+#define LAZYDEEP1_EMBEDDING_HPP
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include "Operator.hpp"
+#include "../Variable.hpp"
+
+namespace lazy::nn {
+
+    namespace detail {
+
+        // lookups of the last forward pass
+        struct EmbeddingState {
+            Index rows = 0, cols = 0;           // shape of the table
+            std::vector<Index> indices;         // column of the table per lookup
+            std::vector<Index> columns;         // distinct columns, increasing
+            std::vector<Index> slots;           // position in columns per lookup
+
+            template<typename S>
+            void record(Index table_rows, Index table_cols, const Matrix<S>& idx){
+                rows = table_rows;
+                cols = table_cols;
+                indices.resize(static_cast<std::size_t>(idx.size()));
+                for(Index j = 0; j < idx.size(); ++j){
+                    const Index c = static_cast<Index>(idx(j));
+                    if(c < 0 || c >= cols)
+                        throw std::runtime_error("lazy: embedding index out of range");
+                    indices[j] = c;
+                }
+
+                columns = indices;
+                std::sort(columns.begin(), columns.end());
+                columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
+                slots.resize(indices.size());
+                for(std::size_t j = 0; j < indices.size(); ++j){
+                    slots[j] = std::lower_bound(columns.begin(), columns.end(), indices[j]) - columns.begin();
+                }
+            }
+        };
+    }
+
+    /*
+     * Embedding lookup : column j of the output is column indices(j) of the table
+     * table : features x entries, indices : any shape, n values in [0, entries) -> features x n
+     * Both passes cost O(features * n) whatever the number of entries : the delta of the table
+     * is also given as the touched columns only (see Operand::diffColumns), which the optimizers
+     * apply to those columns alone. d(ret) / d(indices) is 0.
+     */
+
+    template<typename T1, typename T2>
+    [[nodiscard]] decltype(auto) embedding
+            (const T1 &table, const T2 &indices){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        static_assert(value_traits<ValueType>::column_deltas, "lazy: embedding needs a matrix table");
+        auto state = std::make_shared<detail::EmbeddingState>();
+
+        auto ret = make_operand<ValueType>();
+        ret->getPreOperand().insert({table, indices});
+        ret->setFunction([table, indices, state]() -> ValueType {
+            ValueType out;
+            if(auto var = std::dynamic_pointer_cast<Variable<ValueType>>(table)){
+                // through the variable, which may not keep the table in memory (MappedVariable)
+                state->record(var->rows(), var->cols(), indices->eval());
+                var->readColumns(state->indices, out);
+            } else {
+                const auto& w = table->eval();
+                state->record(w.rows(), w.cols(), indices->eval());
+                out.resize(w.rows(), static_cast<Index>(state->indices.size()));
+                for(Index j = 0; j < out.cols(); ++j) out.col(j) = w.col(state->indices[j]);
+            }
+            return out;
+        });
+
+        table->getPostOperand().insert({ret});
+        indices->getPostOperand().insert({ret});
+        table->detachValue(ret);
+        indices->detachValue(ret);
+
+        table->getScatterDF()[ret] = [ret, state](const PtrType& E, ValueType& cache, bool initialized){
+            const auto& d = ret->diff(E);
+            if(!initialized) cache = ValueType::Zero(state->rows, state->cols);
+            for(Index j = 0; j < d.cols(); ++j) cache.col(state->indices[j]) += d.col(j);
+        };
+        table->getColumnDF()[ret] = [ret, state](const PtrType& E, ColumnDelta<ValueType>& out){
+            const auto& d = ret->diff(E);
+            const Index first = static_cast<Index>(out.columns.size());
+            const Index n = static_cast<Index>(state->columns.size());
+
+            out.columns.insert(out.columns.end(), state->columns.begin(), state->columns.end());
+            out.values.conservativeResize(state->rows, first + n);
+            out.values.middleCols(first, n).setZero();
+            for(Index j = 0; j < d.cols(); ++j) out.values.col(first + state->slots[j]) += d.col(j);
+        };
+
+        return ret;
+    }
+}
+
+#endif //LAZYDEEP1_EMBEDDING_HPP
@@ -0,0 +1,358 @@
+#ifndef LAZYDEEP1_FUNCTOR_HPP
+#define LAZYDEEP1_FUNCTOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "../Operand.hpp"
+
+/*
+ * Element-wise functors for the built-in operators
+ *
+ * Each functor follows Eigen's functor protocol (operator() + packetOp + functor_traits),
+ * so unaryExpr() on them is evaluated with SIMD packets instead of one scalar at a time.
+ *
+ * Derivative functors of exp, tanh, sigmoid, relu and softsign take the forward output y,
+ * to be used with derivative_of::output.
+ */
+
+namespace lazy::functor {
+
+    /*
+     * packet helpers
+     */
+
+    // 1 where a > 0, 0 elsewhere
+    template<typename Packet>
+    inline Packet ppositive(const Packet& a){
+        return a > Packet(0) ? Packet(1) : Packet(0);
+    }
+
+#ifdef EIGEN_VECTORIZE_AVX
+    inline Eigen::internal::Packet8f ppositive(const Eigen::internal::Packet8f& a){
+        return _mm256_and_ps(_mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_set1_ps(1.f));
+    }
+    inline Eigen::internal::Packet4d ppositive(const Eigen::internal::Packet4d& a){
+        return _mm256_and_pd(_mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_GT_OQ), _mm256_set1_pd(1.));
+    }
+#endif
+#ifdef EIGEN_VECTORIZE_SSE2
+    inline Eigen::internal::Packet4f ppositive(const Eigen::internal::Packet4f& a){
+        return _mm_and_ps(_mm_cmpgt_ps(a, _mm_setzero_ps()), _mm_set1_ps(1.f));
+    }
+    inline Eigen::internal::Packet2d ppositive(const Eigen::internal::Packet2d& a){
+        return _mm_and_pd(_mm_cmpgt_pd(a, _mm_setzero_pd()), _mm_set1_pd(1.));
+    }
+#endif
+
+    // whether ppositive() has an overload for the native packets
+#ifdef EIGEN_VECTORIZE_SSE2
+    constexpr bool has_ppositive = true;
+#else
+    constexpr bool has_ppositive = false;
+#endif
+
+    /*
+     * exp / log
+     */
+
+    template<typename Scalar>
+    using exp_op = Eigen::internal::scalar_exp_op<Scalar>;
+
+    // exp'(x) = y
+    template<typename Scalar>
+    struct exp_derivative_op {
+        Scalar operator()(const Scalar& y) const {
+            return y;
+        }
+
+        template<typename Packet>
+        Packet packetOp(const Packet& y) const {
+            return y;
+        }
+    };
+
+    template<typename Scalar>
+    using log_op = Eigen::internal::scalar_log_op<Scalar>;
+
+    template<typename Scalar>
+    using inverse_op = Eigen::internal::scalar_inverse_op<Scalar>;
+
+    /*
+     * pow
+     * small integral exponents are computed by repeated squaring, which is exact for negative
+     * bases as well; other exponents as exp(ex * log(a)), with Eigen's packet exp / log
+     * (NaN for negative bases, as std::pow). The scalar path, which Eigen uses for the
+     * trailing elements, follows the same formulas.
+     */
+
+    template<typename Scalar>
+    struct pow_op {
+        explicit pow_op(Scalar ex)
+        : m_ex(ex), m_integral(std::abs(ex) <= 64 && ex == std::round(ex)),
+        m_n(m_integral ? static_cast<unsigned>(std::abs(ex)) : 0u) {
+
+        }
+
+        Scalar operator()(const Scalar& a) const {
+            if(m_integral)
+                return square<Scalar>(a, Scalar(1), [](const Scalar& x, const Scalar& y){ return x * y; },
+                        [](const Scalar& x, const Scalar& y){ return x / y; });
+            return std::exp(m_ex * std::log(a));
+        }
+
+        template<typename Packet>
+        Packet packetOp(const Packet& a) const {
+            using namespace Eigen::internal;
+            if(m_integral)
+                return square<Packet>(a, pset1<Packet>(Scalar(1)), [](const Packet& x, const Packet& y){ return pmul(x, y); },
+                        [](const Packet& x, const Packet& y){ return pdiv(x, y); });
+            return pexp(pmul(pset1<Packet>(m_ex), plog(a)));
+        }
+
+        Scalar m_ex;
+        bool m_integral;
+        unsigned m_n;
+
+    private:
+        template<typename V, typename Mul, typename Div>
+        V square(const V& a, const V& one, Mul mul, Div div) const {
+            V base = m_ex < 0 ? div(one, a) : a;
+            V ret = one;
+            for(unsigned n = m_n; n; n >>= 1){
+                if(n & 1u) ret = mul(ret, base);
+                base = mul(base, base);
+            }
+            return ret;
+        }
+    };
+
+    template<typename Scalar>
+    struct pow_derivative_op {
+        explicit pow_derivative_op(Scalar ex)
+        : m_ex(ex), m_pow(ex - 1) {
+
+        }
+
+        Scalar operator()(const Scalar& a) const {
+            return m_ex == 0 ? Scalar(0) : m_ex * m_pow(a);
+        }
+
+        template<typename Packet>
+        Packet packetOp(const Packet& a) const {
+            using namespace Eigen::internal;
+            if(m_ex == 0)
+                return pset1<Packet>(Scalar(0));
+            return pmul(pset1<Packet>(m_ex), m_pow.packetOp(a));
+        }
+
+        Scalar m_ex;
+        pow_op<Scalar> m_pow;
+    };
+
+    /*
+     * tanh
+     */
+
+    template<typename Scalar>
+    using tanh_op = Eigen::internal::scalar_tanh_op<Scalar>;
+
+    // tanh'(x) = 1 - y^2
+    template<typename Scalar>
+    struct tanh_derivative_op {
+        Scalar operator()(const Scalar& y) const {
+            return Scalar(1) - y * y;
+        }
+
+        template<typename Packet>
+        Packet packetOp(const Packet& y) const {
+            using namespace Eigen::internal;
+            return psub(pset1<Packet>(Scalar(1)), pmul(y, y));
+        }
+    };
+
+    /*
+     * sigmoid
+     * computed as 1 / (1 + exp(-a)) : it tends to 0 with exp(-a) instead of rounding to exactly 0
+     * for large negative a. a is clamped where exp(-a) would overflow, since the packet division
+     * (a refined reciprocal) gives NaN for 1 / inf.
+     */
+
+    template<typename Scalar>
+    struct sigmoid_op {
+        // -(max_exponent - 1) ln 2 : exp(-a) stays finite above
+        static constexpr Scalar lowest = -Scalar(std::numeric_limits<Scalar>::max_exponent - 1) * Scalar(0.6931471805599453);
+
+        Scalar operator()(const Scalar& a) const {
+            return Scalar(1) / (Scalar(1) + Eigen::numext::exp(-std::max(a, lowest)));
+        }
+
+        template<typename Packet>
+        Packet packetOp(const Packet& a) const {
+            using namespace Eigen::internal;
+            const Packet one = pset1<Packet>(Scalar(1));
+            return pdiv(one, padd(one, pexp(pnegate(pmax(a, pset1<Packet>(lowest))))));
+        }
+    };
+
+    // sigmoid'(x) = y (1 - y)
+    template<typename Scalar>
+    struct sigmoid_derivative_op {
+        Scalar operator()(const Scalar& y) const {
+            return y * (Scalar(1) - y);
+        }
+
+        template<typename Packet>
+        Packet packetOp(const Packet& y) const {
+            using namespace Eigen::internal;
+            return pmul(y, psub(pset1<Packet>(Scalar(1)), y));
+        }
+    };
+
+    /*
+     * relu
+     */
+
+    template<typename Scalar>
+    struct relu_op {
+        Scalar operator()(const Scalar& a) const {
+            return a > 0 ? a : Scalar(0);
+        }
+
+        template<typename Packet>
+        Packet packetOp(const Packet& a) const {
+            using namespace Eigen::internal;
+            return pmax(a, pset1<Packet>(Scalar(0)));
+        }
+    };
+
+    // relu'(x) = 1 if y > 0
+    template<typename Scalar>
+    struct relu_derivative_op {
+        Scalar operator()(const Scalar& y) const {
+            return ppositive(y);
+        }
+
+        template<typename Packet>
+        Packet packetOp(const Packet& y) const {
+            return ppositive(y);
+        }
+    };
+
+    /*
+     * softsign
+     */
+
+    template<typename Scalar>
+    struct softsign_op {
+        Scalar operator()(const Scalar& a) const {
+            return a / (std::abs(a) + 1);
+        }
+
+        template<typename Packet>
+        Packet packetOp(const Packet& a) const {
+            using namespace Eigen::internal;
+            return pdiv(a, padd(pabs(a), pset1<Packet>(Scalar(1))));
+        }
+    };
+
+    // softsign'(x) = (1 - |y|)^2
+    template<typename Scalar>
+    struct softsign_derivative_op {
+        Scalar operator()(const Scalar& y) const {
+            const Scalar d = 1 - std::abs(y);
+            return d * d;
+        }
+
+        template<typename Packet>
+        Packet packetOp(const Packet& y) const {
+            using namespace Eigen::internal;
+            const Packet d = psub(pset1<Packet>(Scalar(1)), pabs(y));
+            return pmul(d, d);
+        }
+    };
+}
+
+namespace Eigen::internal {
+    template<typename Scalar>
+    struct functor_traits<lazy::functor::exp_derivative_op<Scalar>> {
+        enum {
+            Cost = 0,
+            PacketAccess = true
+        };
+    };
+
+    template<typename Scalar>
+    struct functor_traits<lazy::functor::pow_op<Scalar>> {
+        enum {
+            Cost = functor_traits<scalar_exp_op<Scalar>>::Cost + functor_traits<scalar_log_op<Scalar>>::Cost,
+            PacketAccess = packet_traits<Scalar>::HasExp && packet_traits<Scalar>::HasLog && packet_traits<Scalar>::HasDiv
+        };
+    };
+
+    template<typename Scalar>
+    struct functor_traits<lazy::functor::pow_derivative_op<Scalar>> {
+        enum {
+            Cost = functor_traits<lazy::functor::pow_op<Scalar>>::Cost + NumTraits<Scalar>::MulCost,
+            PacketAccess = functor_traits<lazy::functor::pow_op<Scalar>>::PacketAccess
+        };
+    };
+
+    template<typename Scalar>
+    struct functor_traits<lazy::functor::tanh_derivative_op<Scalar>> {
+        enum {
+            Cost = NumTraits<Scalar>::AddCost + NumTraits<Scalar>::MulCost,
+            PacketAccess = true
+        };
+    };
+
+    template<typename Scalar>
+    struct functor_traits<lazy::functor::sigmoid_op<Scalar>> {
+        enum {
+            Cost = functor_traits<scalar_exp_op<Scalar>>::Cost + 2 * NumTraits<Scalar>::AddCost + scalar_div_cost<Scalar, packet_traits<Scalar>::HasDiv>::value,
+            PacketAccess = packet_traits<Scalar>::HasExp && packet_traits<Scalar>::HasDiv
+        };
+    };
+
+    template<typename Scalar>
+    struct functor_traits<lazy::functor::sigmoid_derivative_op<Scalar>> {
+        enum {
+            Cost = NumTraits<Scalar>::AddCost + NumTraits<Scalar>::MulCost,
+            PacketAccess = true
+        };
+    };
+
+    template<typename Scalar>
+    struct functor_traits<lazy::functor::relu_op<Scalar>> {
+        enum {
+            Cost = NumTraits<Scalar>::AddCost,
+            PacketAccess = packet_traits<Scalar>::HasMax
+        };
+    };
+
+    template<typename Scalar>
+    struct functor_traits<lazy::functor::relu_derivative_op<Scalar>> {
+        enum {
+            Cost = NumTraits<Scalar>::AddCost,
+            PacketAccess = packet_traits<Scalar>::Vectorizable && lazy::functor::has_ppositive
+        };
+    };
+
+    template<typename Scalar>
+    struct functor_traits<lazy::functor::softsign_op<Scalar>> {
+        enum {
+            Cost = 2 * NumTraits<Scalar>::AddCost + scalar_div_cost<Scalar, packet_traits<Scalar>::HasDiv>::value,
+            PacketAccess = packet_traits<Scalar>::HasAbs && packet_traits<Scalar>::HasDiv
+        };
+    };
+
+    template<typename Scalar>
+    struct functor_traits<lazy::functor::softsign_derivative_op<Scalar>> {
+        enum {
+            Cost = 2 * NumTraits<Scalar>::AddCost + NumTraits<Scalar>::MulCost,
+            PacketAccess = packet_traits<Scalar>::HasAbs
+        };
+    };
+}
+
+#endif //LAZYDEEP1_FUNCTOR_HPP
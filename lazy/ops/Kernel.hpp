@@ -0,0 +1,247 @@
+#ifndef LAZYDEEP1_KERNEL_HPP
+#define LAZYDEEP1_KERNEL_HPP
+
+#include <algorithm>
+#include <array>
+#include "Operator.hpp"
+
+namespace lazy {
+
+    /*
+     * Kernel : declarative definition of an operator with N inputs
+     *
+     * shape    : (inputs) -> shape of the output ((rows, cols) for matrices)
+     * forward  : (inputs, out) writes the output into out, which is already sized by shape
+     *            and reuses the storage of the previous evaluation
+     * backward : (inputs, out, dout, din) computes the deltas of all inputs in one call
+     *            din[i] is nullptr when the delta of input i is not needed
+     *            inputs/out are nullptr unless backward_reads_inputs/backward_reads_output
+     *
+     * Leaving backward empty means the delta of the operator is undefined.
+     */
+
+    template<typename T, std::size_t N>
+    struct Kernel {
+        using Inputs = std::array<const T*, N>;
+        using Deltas = std::array<T*, N>;
+        using Shape = typename value_traits<T>::Shape;
+
+        using ShapeFunction = std::function<Shape(const Inputs&)>;
+        using ForwardFunction = std::function<void(const Inputs&, T&)>;
+        using BackwardFunction = std::function<void(const Inputs&, const T*, const T&, const Deltas&)>;
+
+        ShapeFunction shape;
+        ForwardFunction forward;
+        BackwardFunction backward;
+
+        bool backward_reads_inputs = true;
+        bool backward_reads_output = false;
+    };
+
+    template<typename T, std::size_t N>
+    class KernelOperand : public Operand<T> {
+    public:
+        using Pointer = typename Operand<T>::Pointer;
+        using KernelType = Kernel<T, N>;
+
+        explicit KernelOperand(std::shared_ptr<const KernelType> kernel, std::array<Pointer, N> inputs)
+        : Operand<T>(), m_kernel(std::move(kernel)), m_inputs(std::move(inputs)), m_buffer(), m_deltas() {
+            this->m_f = [this]() -> T {
+                return forward();
+            };
+        }
+
+        // Anything about Copy/Move is inhibited
+        KernelOperand(const KernelOperand&) = delete;
+        KernelOperand& operator=(const KernelOperand&) = delete;
+        KernelOperand(KernelOperand&&) = delete;
+        KernelOperand& operator=(KernelOperand&&) = delete;
+
+        void setFunction(typename Operand<T>::Function) override {
+            // the kernel is the function
+        }
+
+        /*
+         * delta of the target E w.r.t. input t (summed if t is given more than once)
+         * One backward call gives the deltas of all inputs; each is moved out to its input, and
+         * the entry is dropped once every input has taken its own. An input asking again (its
+         * delta was reset, not this one) gets a new backward call.
+         */
+        T delta(const typename Operand<T>::Pointer& E, const typename Operand<T>::Pointer& t){
+            auto it = m_deltas.find(E);
+            bool taken = false;
+            if(it != m_deltas.end()){
+                for(std::size_t i = 0; i < N; ++i) taken = taken || (m_inputs[i] == t && it->second.taken[i]);
+            }
+            if(it == m_deltas.end() || taken){
+                m_deltas.erase(E);
+                it = m_deltas.emplace(E, Backward{backward(E), {}}).first;
+            }
+
+            auto& entry = it->second;
+            T ret;
+            bool empty = true;
+            for(std::size_t i = 0; i < N; ++i){
+                if(m_inputs[i] != t) continue;
+                entry.taken[i] = true;
+                if(empty){
+                    ret = std::move(entry.deltas[i]);
+                    empty = false;
+                } else {
+                    ret += entry.deltas[i];
+                }
+            }
+            if(std::all_of(entry.taken.begin(), entry.taken.end(), [](bool b){ return b; })){
+                m_deltas.erase(it);
+            }
+
+            if(ret.size() == 0){
+                ret = value_traits<T>::zeros_like(t->eval());
+            }
+
+            return ret;
+        }
+
+        void resetValue() override {
+            // keep the storage for the next forward pass
+            if(this->m_value.has_value() && !this->m_released){
+                m_buffer = std::move(this->m_value.value());
+            }
+            Operand<T>::resetValue();
+        }
+
+        void resetDelta() override {
+            m_deltas.clear();
+            Operand<T>::resetDelta();
+        }
+
+    protected:
+        std::shared_ptr<const KernelType> m_kernel;
+        std::array<Pointer, N> m_inputs;
+        T m_buffer;
+
+        // deltas of the inputs from one backward call, and which inputs have taken theirs
+        struct Backward {
+            std::array<T, N> deltas;
+            std::array<bool, N> taken;
+        };
+        std::map<Pointer, Backward> m_deltas;
+
+        T forward(){
+            typename KernelType::Inputs in;
+            for(std::size_t i = 0; i < N; ++i) in[i] = &m_inputs[i]->eval();
+
+            T out = std::move(m_buffer);
+            value_traits<T>::resize(out, m_kernel->shape(in));
+            m_kernel->forward(in, out);
+            return out;
+        }
+
+        std::array<T, N> backward(const Pointer& E){
+            typename KernelType::Inputs in{};
+            if(m_kernel->backward_reads_inputs){
+                for(std::size_t i = 0; i < N; ++i) in[i] = &m_inputs[i]->eval();
+            }
+            const T* out = m_kernel->backward_reads_output ? &this->eval() : nullptr;
+            const T& dout = this->diff(E);
+
+            std::array<T, N> ret;
+            typename KernelType::Deltas din{};
+            for(std::size_t i = 0; i < N; ++i){
+                const auto& t = m_inputs[i];
+                if(t->isOptimizable() || !t->getPreOperand().empty()) din[i] = &ret[i];
+            }
+
+            m_kernel->backward(in, out, dout, din);
+            return ret;
+        }
+    };
+
+    template<typename T, std::size_t N>
+    decltype(auto) make_kernel_operand
+            (std::shared_ptr<const Kernel<T, N>> kernel, std::array<typename Operand<T>::Pointer, N> inputs){
+        using PtrType = typename Operand<T>::Pointer;
+
+        auto ret = std::make_shared<KernelOperand<T, N>>(kernel, inputs);
+        for(const auto& t: inputs){
+            ret->getPreOperand().insert({t});
+            t->getPostOperand().insert({ret});
+        }
+
+        if(kernel->backward){
+            for(const auto& t: inputs){
+                if(!kernel->backward_reads_inputs) t->detachValue(ret);
+                t->getDF()[ret] = [ret, t](const PtrType& E) -> T {
+                    return ret->delta(E, t);
+                };
+            }
+            if(kernel->backward_reads_output) ret->retainValue();
+        }
+
+        return ret;
+    }
+
+    /*
+     * define_operator(kernel) returns an operator usable like the built-in ones:
+     *   auto op = define_operator(kernel);
+     *   auto y = op(a, b);
+     */
+
+    template<typename T, std::size_t N>
+    decltype(auto) define_operator(Kernel<T, N> kernel){
+        auto def = std::make_shared<const Kernel<T, N>>(std::move(kernel));
+        return [def](const auto& ...args) {
+            static_assert(sizeof...(args) == N, "lazy: Wrong number of operands");
+            return make_kernel_operand<T, N>(def, {typename Operand<T>::Pointer(args)...});
+        };
+    }
+
+    /*
+     * element-wise kernels from (packet) functors
+     * unary  : y = f(a), df is applied to a or to y depending on wrt
+     * binary : y = f(a, b), df1/df2 are the partial derivatives as binary functors of (a, b)
+     */
+
+    template<typename T, typename F, typename DF>
+    Kernel<T, 1> elementwise_kernel(F f, DF df, derivative_of wrt = derivative_of::input){
+        using K = Kernel<T, 1>;
+
+        K kernel;
+        kernel.shape = [](const typename K::Inputs& in) -> typename K::Shape {
+            return value_traits<T>::shape(*in[0]);
+        };
+        kernel.forward = [f](const typename K::Inputs& in, T& out){
+            out = in[0]->unaryExpr(f);
+        };
+        kernel.backward = [df, wrt](const typename K::Inputs& in, const T* out, const T& dout, const typename K::Deltas& din){
+            if(!din[0]) return;
+            const T& x = wrt == derivative_of::output ? *out : *in[0];
+            *din[0] = dout.cwiseProduct(x.unaryExpr(df));
+        };
+        kernel.backward_reads_inputs = wrt == derivative_of::input;
+        kernel.backward_reads_output = wrt == derivative_of::output;
+
+        return kernel;
+    }
+
+    template<typename T, typename F, typename DF1, typename DF2>
+    Kernel<T, 2> elementwise_kernel(F f, DF1 df1, DF2 df2){
+        using K = Kernel<T, 2>;
+
+        K kernel;
+        kernel.shape = [](const typename K::Inputs& in) -> typename K::Shape {
+            return value_traits<T>::shape(*in[0]);
+        };
+        kernel.forward = [f](const typename K::Inputs& in, T& out){
+            out = in[0]->binaryExpr(*in[1], f);
+        };
+        kernel.backward = [df1, df2](const typename K::Inputs& in, const T*, const T& dout, const typename K::Deltas& din){
+            if(din[0]) *din[0] = dout.cwiseProduct(in[0]->binaryExpr(*in[1], df1));
+            if(din[1]) *din[1] = dout.cwiseProduct(in[0]->binaryExpr(*in[1], df2));
+        };
+
+        return kernel;
+    }
+}
+
+#endif //LAZYDEEP1_KERNEL_HPP
@@ -6,6 +6,7 @@
 #define LAZYDEEP1_MATH_HPP
 
 #include "Operator.hpp"
+#include "Functor.hpp"
 
 namespace lazy::math {
     template<typename T>
@@ -14,8 +15,9 @@ namespace lazy::math {
         LAZY_TYPEDEF_OPERATOR(T);
 
         return unaryExpr(t,
-                         [](ScalarType f)->ScalarType{return std::exp(f);},
-                         [](ScalarType f)->ScalarType{return std::exp(f);});
+                         functor::exp_op<ScalarType>(),
+                         functor::exp_derivative_op<ScalarType>(),
+                         derivative_of::output);
     }
 
     template<typename T>
@@ -24,8 +26,8 @@ namespace lazy::math {
         LAZY_TYPEDEF_OPERATOR(T);
 
         return unaryExpr(t,
-                         [](ScalarType f)->ScalarType{return std::log(f);},
-                         [](ScalarType f)->ScalarType{return 1 / f;});
+                         functor::log_op<ScalarType>(),
+                         functor::inverse_op<ScalarType>());
     }
 
     template<typename T, typename S>
@@ -34,11 +36,8 @@ namespace lazy::math {
         LAZY_TYPEDEF_OPERATOR(T);
 
         return unaryExpr(t,
-                         [ex](ScalarType f)->ScalarType{return std::pow(f, ex);},
-                         [ex](ScalarType f)->ScalarType{
-            if(ex == 0)
-                return 0;
-            return ex * std::pow(f, ex-1);});
+                         functor::pow_op<ScalarType>(ex),
+                         functor::pow_derivative_op<ScalarType>(ex));
     }
 
     template<typename T>
@@ -47,8 +46,9 @@ namespace lazy::math {
         LAZY_TYPEDEF_OPERATOR(T);
 
         return unaryExpr(t,
-                         [](ScalarType f)->ScalarType{return std::tanh(f);},
-                         [](ScalarType f)->ScalarType{return std::pow(std::cosh(f), ScalarType(-2));});
+                         functor::tanh_op<ScalarType>(),
+                         functor::tanh_derivative_op<ScalarType>(),
+                         derivative_of::output);
     }
 
     template<typename T>
@@ -57,8 +57,9 @@ namespace lazy::math {
         LAZY_TYPEDEF_OPERATOR(T);
 
         return unaryExpr(t,
-                         [](ScalarType f)->ScalarType{return 1 / (1 + std::exp(-f));},
-                         [](ScalarType f)->ScalarType{return std::exp(-f) / std::pow(1 + std::exp(-f), ScalarType(2));});
+                         functor::sigmoid_op<ScalarType>(),
+                         functor::sigmoid_derivative_op<ScalarType>(),
+                         derivative_of::output);
     }
 }
 
@@ -6,6 +6,7 @@
 #define LAZYDEEP1_NN_HPP
 
 #include "Math.hpp"
+#include "BitMask.hpp"
 
 namespace lazy::nn {
 
@@ -22,9 +23,26 @@ namespace lazy::nn {
             (const T &t){
         LAZY_TYPEDEF_OPERATOR(T);
 
-        return unaryExpr(t,
-                [](ScalarType f)->ScalarType{return f > 0 ? f : 0;},
-                [](ScalarType f)->ScalarType{return f > 0;});
+        // the backward pass only needs the signs of t, kept as bits
+        auto mask = std::make_shared<BitMask>();
+
+        auto ret = make_operand<ValueType>();
+        ret->getPreOperand().insert({t});
+        ret->setFunction([t, mask]() -> ValueType {
+            ValueType y;
+            mask->relu(t->eval(), y);
+            return y;
+        });
+
+        t->getPostOperand().insert({ret});
+        t->detachValue(ret);
+        t->getDF()[ret] = [ret, mask](const PtrType& E) -> ValueType {
+            ValueType d;
+            mask->select(ret->diff(E), d);
+            return d;
+        };
+
+        return ret;
     }
 
     template<typename T>
@@ -33,8 +51,9 @@ namespace lazy::nn {
         LAZY_TYPEDEF_OPERATOR(T);
 
         return unaryExpr(t,
-                         [](ScalarType f)->ScalarType{return f / (std::abs(f) + 1);},
-                         [](ScalarType f)->ScalarType{return std::pow(std::abs(f) + 1, ScalarType(-2));});
+                         functor::softsign_op<ScalarType>(),
+                         functor::softsign_derivative_op<ScalarType>(),
+                         derivative_of::output);
     }
 
     template<typename T>
@@ -45,16 +64,16 @@ namespace lazy::nn {
         auto ret = make_operand<ValueType>();
         ret->getPreOperand().insert({t});
         t->getPostOperand().insert({ret});
+        t->detachValue(ret);
+        ret->retainValue();
 
         if(axis == input_type::colwise) {
             ret->setFunction([t]() -> ValueType {
                 const auto& m = t->eval();
-                const auto ex = (m.rowwise() - m.colwise().maxCoeff())
-                        .unaryExpr([](ScalarType x) { return std::exp(x); });
-                const auto ex_sum = ex.colwise().sum()
-                        .unaryExpr([](ScalarType x) { return std::pow(x, static_cast<ScalarType>(-1)); })
-                        .row(0).asDiagonal();
-                return ex * ex_sum;
+                ValueType ex = (m.rowwise() - m.colwise().maxCoeff()).array().exp().matrix();
+                const ValueType ex_sum = ex.colwise().sum().cwiseInverse();
+                ex.array().rowwise() *= ex_sum.row(0).array();
+                return ex;
             });
 
             t->getDF()[ret] = [ret](const PtrType& E) -> ValueType {
@@ -68,12 +87,10 @@ namespace lazy::nn {
         else {
             ret->setFunction([t]() -> ValueType {
                 const auto& m = t->eval();
-                const auto ex = (m.colwise() - m.rowwise().maxCoeff())
-                        .unaryExpr([](ScalarType x) { return std::exp(x); });
-                const auto ex_sum = ex.rowwise().sum()
-                        .unaryExpr([](ScalarType x) { return std::pow(x, static_cast<ScalarType>(-1)); })
-                        .col(0).asDiagonal();
-                return ex_sum * ex;
+                ValueType ex = (m.colwise() - m.rowwise().maxCoeff()).array().exp().matrix();
+                const ValueType ex_sum = ex.rowwise().sum().cwiseInverse();
+                ex.array().colwise() *= ex_sum.col(0).array();
+                return ex;
             });
             t->getDF()[ret] = [ret](const PtrType& E) -> ValueType {
                 const auto& m = ret->eval();
@@ -118,32 +135,51 @@ namespace lazy::nn {
             (const T1 &t, const T2 &attr){
         LAZY_TYPEDEF_OPERATOR(T1);
 
-        auto mask = make_operand<ValueType>();
-        mask->getPreOperand().insert({t, attr});
-        mask->setFunction([t, attr]() -> ValueType {
-            const auto& ratio = attr->eval()(0);
-            const auto& train = attr->eval()(1);
-            if(train){
-                std::random_device rd;
-                std::mt19937 gen{rd()};
-                std::bernoulli_distribution dist(ratio);
-                return t->eval().unaryExpr([&dist, &gen](ScalarType)->ScalarType{
-                    return dist(gen);
-                });
+        // each dropout node has its own stream, advanced on every training evaluation
+        auto gen = std::make_shared<random::Philox>(random::make_generator());
+
+        // the mask of the last evaluation, kept as bits for the backward pass
+        struct State {
+            BitMask mask;
+            ScalarType ratio = 1;
+            bool train = false;
+        };
+        auto state = std::make_shared<State>();
+
+        auto ret = make_operand<ValueType>();
+        ret->getPreOperand().insert({t, attr});
+        ret->setFunction([t, attr, gen, state]() -> ValueType {
+            state->ratio = attr->eval()(0);
+            state->train = attr->eval()(1) != 0;
+
+            const auto& x = t->eval();
+            if(state->train){
+                ValueType y;
+                state->mask.bernoulli(x.size(), state->ratio, *gen);
+                state->mask.select(x, y);
+                return y;
             } else {
-                return t->eval().unaryExpr([ratio](ScalarType)->ScalarType{
-                    return ratio;
-                });
+                return x * state->ratio;
             }
         });
 
-        t->getPostOperand().insert({mask});
-        // d(mask) / dt is undefined
+        t->getPostOperand().insert({ret});
+        t->detachValue(ret);
+        t->getDF()[ret] = [ret, state](const PtrType& E) -> ValueType {
+            const auto& d = ret->diff(E);
+            if(state->train){
+                ValueType dt;
+                state->mask.select(d, dt);
+                return dt;
+            } else {
+                return d * state->ratio;
+            }
+        };
 
-        attr->getPostOperand().insert({mask});
-        // d(mask) / d(attr) is undefined
+        attr->getPostOperand().insert({ret});
+        // d(ret) / d(attr) is undefined
 
-        return hadamard_product(t, mask);
+        return ret;
     }
 
 
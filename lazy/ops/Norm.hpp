@@ -0,0 +1,465 @@
+#ifndef LAZYDEEP1_NORM_HPP
+#define LAZYDEEP1_NORM_HPP
+
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include "Kernel.hpp"
+#include "NN.hpp"
+#include "../Variable.hpp"
+
+namespace lazy::nn {
+
+    namespace detail {
+
+        /*
+         * Moments in one pass (Welford)
+         * welford : count steps of `lanes` contiguous values, `stride` apart; every lane keeps its own
+         *           mean and M2 (sum of squared deviations), so the update vectorizes across lanes
+         * merge   : Chan et al.'s combination of two (count, mean, M2)
+         */
+
+        template<typename S>
+        void welford(const S* x, Index lanes, Index count, Index stride, S* mean, S* m2){
+            for(Index i = 0; i < lanes; ++i) mean[i] = m2[i] = S(0);
+            for(Index k = 0; k < count; ++k, x += stride){
+                const S inv = S(1) / static_cast<S>(k + 1);
+                for(Index i = 0; i < lanes; ++i){
+                    const S d = x[i] - mean[i];
+                    mean[i] += d * inv;
+                    m2[i] += d * (x[i] - mean[i]);
+                }
+            }
+        }
+
+        template<typename S>
+        void merge_moments(Index& n, S& mean, S& m2, Index nb, S mean_b, S m2_b){
+            if(nb == 0) return;
+            const Index total = n + nb;
+            const S d = mean_b - mean;
+            const S w = static_cast<S>(nb) / static_cast<S>(total);
+            mean += d * w;
+            m2 += m2_b + d * d * static_cast<S>(n) * w;
+            n = total;
+        }
+
+        // mean and population variance of every group (a row if row_groups, else a column), as groups x 1
+        template<typename S>
+        void moments(const Matrix<S>& x, bool row_groups, Matrix<S>& mean, Matrix<S>& var){
+            const Index rows = x.rows(), cols = x.cols();
+            if(row_groups){
+                mean.resize(rows, 1);
+                var.resize(rows, 1);
+                welford(x.data(), rows, cols, rows, mean.data(), var.data());
+                var /= static_cast<S>(std::max<Index>(cols, 1));
+                return;
+            }
+
+            // a column is cut into lanes x (rows / lanes), the lanes merged, then the leftover values
+            constexpr Index lanes = 16;
+            const Index steps = rows / lanes;
+            mean.resize(cols, 1);
+            var.resize(cols, 1);
+            for(Index j = 0; j < cols; ++j){
+                const S* col = x.col(j).data();
+                std::array<S, lanes> lane_mean, lane_m2;
+                welford(col, lanes, steps, lanes, lane_mean.data(), lane_m2.data());
+
+                Index n = 0;
+                S mu = 0, m2 = 0;
+                if(steps > 0){
+                    for(Index i = 0; i < lanes; ++i) merge_moments(n, mu, m2, steps, lane_mean[i], lane_m2[i]);
+                }
+                for(Index i = steps * lanes; i < rows; ++i) merge_moments(n, mu, m2, Index(1), col[i], S(0));
+
+                mean(j, 0) = mu;
+                var(j, 0) = m2 / static_cast<S>(std::max<Index>(rows, 1));
+            }
+        }
+
+        /*
+         * Normalization of a matrix by groups : y = gamma * (x - mean) * rstd + beta
+         *
+         * RowGroups : every row is a group (statistics across the columns), otherwise every column
+         * RowGamma  : gamma / beta are rows x 1 (one per row), otherwise 1 x cols
+         * batch norm has one gamma per group (RowGroups == RowGamma), layer norm one per feature
+         * of a group (RowGroups != RowGamma).
+         * Everything runs column by column, with x^ = (x - mean) * rstd recomputed from x
+         * instead of being stored.
+         */
+
+        template<typename S>
+        struct Normalization {
+            using MatrixType = Matrix<S>;
+
+            bool row_groups;
+            bool row_gamma;
+
+            template<typename F>
+            void dispatch(F&& f) const {
+                if(row_groups){
+                    if(row_gamma) f(std::true_type(), std::true_type());
+                    else f(std::true_type(), std::false_type());
+                } else {
+                    if(row_gamma) f(std::false_type(), std::true_type());
+                    else f(std::false_type(), std::false_type());
+                }
+            }
+
+            void forward(const MatrixType& x, const MatrixType& mean, const MatrixType& rstd,
+                    const MatrixType& gamma, const MatrixType& beta, MatrixType& y) const {
+                dispatch([&](auto row_groups, auto row_gamma){
+                    const Access<decltype(row_groups)::value, decltype(row_gamma)::value> at{x, mean, rstd, gamma, beta};
+                    for(Index j = 0; j < x.cols(); ++j)
+                        y.col(j).array() = at.xhat(j) * at.gamma(j) + at.beta(j);
+                });
+            }
+
+            // constant_stats : mean and rstd do not depend on x (running statistics)
+            void backward(const MatrixType& x, const MatrixType& mean, const MatrixType& rstd,
+                    const MatrixType& gamma, const MatrixType& dy, bool constant_stats,
+                    MatrixType* dx, MatrixType* dgamma, MatrixType* dbeta) const {
+                const Index rows = x.rows(), cols = x.cols();
+                if(dgamma) dgamma->setZero(gamma.rows(), gamma.cols());
+                if(dbeta) dbeta->setZero(gamma.rows(), gamma.cols());
+                if(dx) dx->resize(rows, cols);
+
+                dispatch([&](auto row_groups, auto row_gamma){
+                    constexpr bool RowGroups = decltype(row_groups)::value, RowGamma = decltype(row_gamma)::value;
+                    // (beta is not needed)
+                    const Access<RowGroups, RowGamma> at{x, mean, rstd, gamma, gamma};
+
+                    // dx = rstd * (dx^ - mean(dx^) - x^ * mean(dx^ * x^)) over each group, dx^ = dy * gamma
+                    const bool sums = dx && !constant_stats;
+                    const S inv_n = S(1) / static_cast<S>(std::max<Index>(RowGroups ? cols : rows, 1));
+                    MatrixType s1, s2;
+                    if(sums && RowGroups){
+                        s1.setZero(rows, 1);
+                        s2.setZero(rows, 1);
+                    }
+
+                    for(Index j = 0; j < cols; ++j){
+                        const auto xhat = at.xhat(j);
+                        const auto d = dy.col(j).array();
+                        const auto dxhat = d * at.gamma(j);
+
+                        if constexpr (RowGamma){
+                            if(dgamma) dgamma->col(0).array() += d * xhat;
+                            if(dbeta) dbeta->col(0).array() += d;
+                        } else {
+                            if(dgamma) (*dgamma)(0, j) = (d * xhat).sum();
+                            if(dbeta) (*dbeta)(0, j) = d.sum();
+                        }
+
+                        if(!dx) continue;
+                        if(constant_stats){
+                            dx->col(j).array() = dxhat * at.rstd(j);
+                        } else if constexpr (RowGroups){
+                            s1.col(0).array() += dxhat;
+                            s2.col(0).array() += dxhat * xhat;
+                        } else {
+                            // the column is still in cache for the second pass
+                            const S m1 = dxhat.sum() * inv_n, m2 = (dxhat * xhat).sum() * inv_n;
+                            dx->col(j).array() = at.rstd(j) * (dxhat - m1 - xhat * m2);
+                        }
+                    }
+
+                    if constexpr (RowGroups){
+                        if(sums){
+                            s1 *= inv_n;
+                            s2 *= inv_n;
+                            for(Index j = 0; j < cols; ++j){
+                                const auto xhat = at.xhat(j);
+                                const auto dxhat = dy.col(j).array() * at.gamma(j);
+                                dx->col(j).array() = at.rstd(j) * (dxhat - s1.col(0).array() - xhat * s2.col(0).array());
+                            }
+                        }
+                    }
+                });
+            }
+
+        private:
+            // per column j : x^, gamma, beta and rstd as arrays (per row) or scalars
+            template<bool RowGroups, bool RowGamma>
+            struct Access {
+                const MatrixType& x;
+                const MatrixType& mu;
+                const MatrixType& r;
+                const MatrixType& g;
+                const MatrixType& b;
+
+                decltype(auto) rstd(Index j) const {
+                    if constexpr (RowGroups) return r.col(0).array();
+                    else return r(j, 0);
+                }
+                decltype(auto) xhat(Index j) const {
+                    if constexpr (RowGroups) return (x.col(j).array() - mu.col(0).array()) * r.col(0).array();
+                    else return (x.col(j).array() - mu(j, 0)) * r(j, 0);
+                }
+                decltype(auto) gamma(Index j) const {
+                    if constexpr (RowGamma) return g.col(0).array();
+                    else return g(0, j);
+                }
+                decltype(auto) beta(Index j) const {
+                    if constexpr (RowGamma) return b.col(0).array();
+                    else return b(0, j);
+                }
+            };
+        };
+
+        template<typename S>
+        Matrix<S> inverse_std(const Matrix<S>& var, S eps){
+            return (var.array() + eps).rsqrt().matrix();
+        }
+    }
+
+    /*
+     * Batch normalization
+     * colwise : features are rows, normalized across the batch (columns); gamma / beta are rows x 1
+     * rowwise : features are columns, normalized across the rows; gamma / beta are 1 x cols
+     *
+     * attr (batch_norm_attr_matrix) selects training, which normalizes with the batch statistics
+     * and moves the running statistics toward them by momentum, or inference, which normalizes
+     * with the running statistics. The running statistics live in a BatchNormStatistics the caller
+     * keeps (for fold_batch_norm).
+     * d(ret) / d(attr) is undefined.
+     */
+
+    template<typename T>
+    struct BatchNormStatistics {
+        T mean;     // features x 1
+        T var;      // features x 1, unbiased
+        typename T::Scalar eps = 1e-5;
+        input_type axis = input_type::colwise;
+    };
+
+    template<typename T>
+    decltype(auto) make_batch_norm_statistics(){
+        return std::make_shared<BatchNormStatistics<T>>();
+    }
+
+    template<typename T> T batch_norm_attr_matrix
+            (typename T::Scalar momentum, bool train){
+        T ret(2, 1);
+        ret << momentum, static_cast<typename T::Scalar>(train);
+        return ret;
+    }
+
+    template<typename T1, typename T2, typename T3, typename T4>
+    [[nodiscard]] decltype(auto) batch_norm
+            (const T1 &t, const T2 &gamma, const T3 &beta, const T4 &attr,
+             const std::shared_ptr<BatchNormStatistics<typename T1::element_type::ValueType>>& stats,
+             input_type axis, typename T1::element_type::ValueType::Scalar eps = 1e-5){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        using K = Kernel<ValueType, 4>;
+        const bool rows = axis == input_type::colwise;
+        const auto norm = std::make_shared<const detail::Normalization<ScalarType>>(
+                detail::Normalization<ScalarType>{rows, rows});
+
+        stats->eps = eps;
+        stats->axis = axis;
+
+        // statistics used by the last forward pass
+        struct State {
+            ValueType mean, rstd;
+            bool train = false;
+        };
+        const auto state = std::make_shared<State>();
+
+        K kernel;
+        kernel.shape = [rows](const typename K::Inputs& in) -> typename K::Shape {
+            const Index features = rows ? in[0]->rows() : in[0]->cols();
+            const Index gr = rows ? features : 1, gc = rows ? 1 : features;
+            if(in[1]->rows() != gr || in[1]->cols() != gc || in[2]->rows() != gr || in[2]->cols() != gc)
+                throw std::runtime_error("lazy: batch_norm shapes do not match");
+            return {in[0]->rows(), in[0]->cols()};
+        };
+        kernel.forward = [norm, stats, state, rows, eps](const typename K::Inputs& in, ValueType& out){
+            const auto& x = *in[0];
+            const ScalarType momentum = (*in[3])(0);
+            state->train = (*in[3])(1) != 0;
+
+            if(state->train){
+                ValueType var;
+                detail::moments(x, rows, state->mean, var);
+                state->rstd = detail::inverse_std(var, eps);
+
+                const Index n = rows ? x.cols() : x.rows();
+                if(stats->mean.rows() != state->mean.rows()){
+                    stats->mean = ValueType::Zero(state->mean.rows(), 1);
+                    stats->var = ValueType::Ones(state->mean.rows(), 1);
+                }
+                const ScalarType unbiased = static_cast<ScalarType>(n) / static_cast<ScalarType>(std::max<Index>(n - 1, 1));
+                stats->mean = (1 - momentum) * stats->mean + momentum * state->mean;
+                stats->var = (1 - momentum) * stats->var + (momentum * unbiased) * var;
+            } else {
+                if(stats->mean.rows() != (rows ? x.rows() : x.cols()))
+                    throw std::runtime_error("lazy: batch_norm has no running statistics");
+                state->mean = stats->mean;
+                state->rstd = detail::inverse_std(stats->var, eps);
+            }
+
+            norm->forward(x, state->mean, state->rstd, *in[1], *in[2], out);
+        };
+        kernel.backward = [norm, state](const typename K::Inputs& in, const ValueType*, const ValueType& dout,
+                const typename K::Deltas& din){
+            norm->backward(*in[0], state->mean, state->rstd, *in[1], dout, !state->train, din[0], din[1], din[2]);
+        };
+
+        return make_kernel_operand<ValueType, 4>(std::make_shared<const K>(std::move(kernel)),
+                {PtrType(t), PtrType(gamma), PtrType(beta), PtrType(attr)});
+    }
+
+    /*
+     * Layer normalization
+     * colwise : every column (sample) is normalized over its rows; gamma / beta are rows x 1
+     * rowwise : every row (sample) is normalized over its columns; gamma / beta are 1 x cols
+     */
+
+    template<typename T1, typename T2, typename T3>
+    [[nodiscard]] decltype(auto) layer_norm
+            (const T1 &t, const T2 &gamma, const T3 &beta, input_type axis,
+             typename T1::element_type::ValueType::Scalar eps = 1e-5){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        using K = Kernel<ValueType, 3>;
+        const bool cols = axis == input_type::colwise;
+        const auto norm = std::make_shared<const detail::Normalization<ScalarType>>(
+                detail::Normalization<ScalarType>{!cols, cols});
+
+        struct State {
+            ValueType mean, rstd;
+        };
+        const auto state = std::make_shared<State>();
+
+        K kernel;
+        kernel.shape = [cols](const typename K::Inputs& in) -> typename K::Shape {
+            const Index features = cols ? in[0]->rows() : in[0]->cols();
+            const Index gr = cols ? features : 1, gc = cols ? 1 : features;
+            if(in[1]->rows() != gr || in[1]->cols() != gc || in[2]->rows() != gr || in[2]->cols() != gc)
+                throw std::runtime_error("lazy: layer_norm shapes do not match");
+            return {in[0]->rows(), in[0]->cols()};
+        };
+        kernel.forward = [norm, state, cols, eps](const typename K::Inputs& in, ValueType& out){
+            ValueType var;
+            detail::moments(*in[0], !cols, state->mean, var);
+            state->rstd = detail::inverse_std(var, eps);
+            norm->forward(*in[0], state->mean, state->rstd, *in[1], *in[2], out);
+        };
+        kernel.backward = [norm, state](const typename K::Inputs& in, const ValueType*, const ValueType& dout,
+                const typename K::Deltas& din){
+            norm->backward(*in[0], state->mean, state->rstd, *in[1], dout, false, din[0], din[1], din[2]);
+        };
+
+        return make_kernel_operand<ValueType, 3>(std::make_shared<const K>(std::move(kernel)),
+                {PtrType(t), PtrType(gamma), PtrType(beta)});
+    }
+
+    /*
+     * fold_batch_norm : a layer with its inference-mode batch norm folded into its weights and bias
+     *
+     *   colwise : batch_norm(W * x + b)  ==  W' * x + b'   (W' = diag(s) W)
+     *   rowwise : batch_norm(x * W + b)  ==  x * W' + b'   (W' = W diag(s))
+     *   with s = gamma / sqrt(var + eps) and b' = s * (b - mean) + beta
+     *
+     * fold_batch_norm(x, W, b, gamma, beta, stats) rewrites the layer for serving : it returns
+     * an operand of W' * x + b' (x * W' + b' for rowwise), where W' and b' are operands computed
+     * from W, b, gamma, beta and stats. They are computed again whenever those variables are
+     * updated, with the running statistics of that time, so a serving graph built next to the
+     * training one follows it. The rewrite only links to x, W, b, gamma and beta for resets
+     * (as link_operand does) and gives them no delta, so backward passes of the training graph
+     * never evaluate it.
+     * An operand cannot tell which of its inputs is which, so the layer is given by its parts
+     * rather than found from the batch_norm node.
+     *
+     * fold_batch_norm(W, b, gamma, beta, stats) gives W' and b' as new variables instead.
+     */
+
+    namespace detail {
+
+        // s = gamma / sqrt(var + eps), and the mean, both shaped as gamma
+        template<typename T>
+        std::pair<T, T> fold_scale(const T& gamma, const BatchNormStatistics<T>& stats){
+            if(stats.mean.size() == 0)
+                throw std::runtime_error("lazy: batch_norm has no running statistics");
+            const T rstd = inverse_std(stats.var, stats.eps);
+            if(stats.axis == input_type::colwise)
+                return {gamma.cwiseProduct(rstd), stats.mean};
+            return {gamma.cwiseProduct(T(rstd.transpose())), T(stats.mean.transpose())};
+        }
+
+        template<typename T>
+        T fold_weight(const T& w, const T& gamma, const BatchNormStatistics<T>& stats){
+            const T s = fold_scale(gamma, stats).first;
+            if(stats.axis == input_type::colwise)
+                return s.col(0).asDiagonal() * w;
+            return w * s.row(0).asDiagonal();
+        }
+
+        template<typename T>
+        T fold_bias(const T& b, const T& gamma, const T& beta, const BatchNormStatistics<T>& stats){
+            const auto [s, mean] = fold_scale(gamma, stats);
+            return s.cwiseProduct(b - mean) + beta;
+        }
+    }
+
+    template<typename T0, typename T1, typename T2, typename T3, typename T4>
+    [[nodiscard]] decltype(auto) fold_batch_norm
+            (const T0 &x, const T1 &w, const T2 &b, const T3 &gamma, const T4 &beta,
+             const std::shared_ptr<BatchNormStatistics<typename T1::element_type::ValueType>>& stats){
+        LAZY_TYPEDEF_OPERATOR(T1);
+
+        auto folded_w = make_operand<ValueType>();
+        folded_w->getPreOperand().insert({w, gamma});
+        folded_w->setFunction([w, gamma, stats]() -> ValueType {
+            return detail::fold_weight(w->eval(), gamma->eval(), *stats);
+        });
+        w->getPostOperand().insert({folded_w});
+        gamma->getPostOperand().insert({folded_w});
+
+        auto folded_b = make_operand<ValueType>();
+        folded_b->getPreOperand().insert({b, gamma, beta});
+        folded_b->setFunction([b, gamma, beta, stats]() -> ValueType {
+            return detail::fold_bias(b->eval(), gamma->eval(), beta->eval(), *stats);
+        });
+        b->getPostOperand().insert({folded_b});
+        gamma->getPostOperand().insert({folded_b});
+        beta->getPostOperand().insert({folded_b});
+
+        const bool cols = stats->axis == input_type::colwise;
+        auto ret = make_operand<ValueType>();
+        ret->getPreOperand().insert({folded_w, folded_b});
+        ret->setFunction([x, folded_w, folded_b, cols]() -> ValueType {
+            if(cols) return (folded_w->eval() * x->eval()).colwise() + folded_b->eval().col(0);
+            return (x->eval() * folded_w->eval()).rowwise() + folded_b->eval().row(0);
+        });
+        x->getPostOperand().insert({ret});
+        folded_w->getPostOperand().insert({ret});
+        folded_b->getPostOperand().insert({ret});
+        // no delta is registered on x or the folded operands : serving only
+
+        return ret;
+    }
+
+    template<typename T1, typename T2, typename T3, typename T4>
+    [[nodiscard]] decltype(auto) fold_batch_norm
+            (const T1 &w, const T2 &b, const T3 &gamma, const T4 &beta,
+             const BatchNormStatistics<typename T1::element_type::ValueType>& stats){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        const auto& g = gamma->eval();
+        return std::make_pair(make_variable<ValueType>(detail::fold_weight(w->eval(), g, stats)),
+                make_variable<ValueType>(detail::fold_bias(b->eval(), g, beta->eval(), stats)));
+    }
+
+    // a layer without bias (dot_product only)
+    template<typename T1, typename T3, typename T4>
+    [[nodiscard]] decltype(auto) fold_batch_norm
+            (const T1 &w, const T3 &gamma, const T4 &beta,
+             const BatchNormStatistics<typename T1::element_type::ValueType>& stats){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        const auto& g = gamma->eval();
+        return fold_batch_norm(w, make_variable<ValueType>(ValueType::Zero(g.rows(), g.cols())), gamma, beta, stats);
+    }
+}
+
+#endif //LAZYDEEP1_NORM_HPP
@@ -5,7 +5,12 @@
 #ifndef LAZYDEEP1_OPERATOR_HPP
 #define LAZYDEEP1_OPERATOR_HPP
 
+#include <atomic>
+#include <cstdint>
 #include "../Operand.hpp"
+#include "../Tensor.hpp"
+#include "../Sparse.hpp"
+#include "Dual.hpp"
 
 #define LAZY_ASSERT_TYPE_SAME(T1, T2) static_assert(std::is_same<T1, T2>::value, "lazy: Types are inconsistent")
 #define LAZY_TYPEDEF_OPERATOR(T) \
@@ -20,11 +25,19 @@ namespace lazy {
 
     /*
      * element-wise mapping
+     * df is applied either to the input (df(x) = f'(x))
+     * or to the cached output (df(y) = f'(x) where y = f(x));
+     * the latter lets the input value be released after the forward pass
      */
 
+    enum class derivative_of {
+        input,
+        output
+    };
+
     template<typename T, typename F1, typename F2>
     [[nodiscard]] decltype(auto) unaryExpr
-            (const T &t, const F1 &func, const F2 &df){
+            (const T &t, const F1 &func, const F2 &df, derivative_of wrt){
         LAZY_TYPEDEF_OPERATOR(T);
 
         auto ret = make_operand<ValueType>();
@@ -34,13 +47,32 @@ namespace lazy {
         });
 
         t->getPostOperand().insert({ret});
-        t->getDF()[ret] = [t, ret, df](const PtrType& E) -> ValueType{
-            return ret->diff(E).cwiseProduct(t->eval().unaryExpr(df));
-        };
+        if(wrt == derivative_of::output){
+            ret->retainValue();
+            t->detachValue(ret);
+            t->getDF()[ret] = [ret, df](const PtrType& E) -> ValueType{
+                return ret->diff(E).cwiseProduct(ret->eval().unaryExpr(df));
+            };
+        } else {
+            t->getDF()[ret] = [t, ret, df](const PtrType& E) -> ValueType{
+                return ret->diff(E).cwiseProduct(t->eval().unaryExpr(df));
+            };
+        }
 
         return ret;
     }
 
+    template<typename T, typename F1, typename F2>
+    [[nodiscard]] decltype(auto) unaryExpr
+            (const T &t, const F1 &func, const F2 &df){
+        return unaryExpr(t, func, df, derivative_of::input);
+    }
+
+    /*
+     * element-wise mapping without a given derivative
+     * the derivative is a central difference
+     */
+
     template<typename T, typename F1>
     [[nodiscard]] decltype(auto) unaryExpr
             (const T &t, const F1 &func){
@@ -52,9 +84,161 @@ namespace lazy {
         return unaryExpr(t, func, df);
     }
 
+    /*
+     * element-wise mapping of a differentiable function (see lazy::differentiable)
+     * The derivative is exact, by forward-mode differentiation with Dual.
+     * Without attr, t keeps its value and the slopes are computed from it on the first
+     * delta after each forward pass, so inference passes evaluate the value only.
+     * With attr (dual_attr_matrix), a training pass evaluates value and slope in the same
+     * call and keeps the slopes for backward, which lets the value of t be released;
+     * an inference pass evaluates the value only, and a delta after it evaluates t again.
+     */
+
+    namespace detail {
+
+        template<typename T>
+        struct DualState {
+            T slope;
+            bool fresh = false;     // slope matches the last forward pass
+        };
+
+        // func(x), and func'(x) into slope if given
+        template<typename T, typename F>
+        T dual_map(const T& x, const F& func, T* slope){
+            using S = typename T::Scalar;
+            if(!slope){
+                return x.unaryExpr([&func](S f)->S{ return Dual<S>(func(Dual<S>(f))).value; });
+            }
+
+            const auto& xs = value_traits<T>::contiguous(x);
+            T y;
+            value_traits<T>::resize(y, value_traits<T>::shape(xs));
+            value_traits<T>::resize(*slope, value_traits<T>::shape(xs));
+            const S* src = xs.data();
+            S* dst = y.data();
+            S* dy = slope->data();
+            for(Index i = 0; i < xs.size(); ++i){
+                const Dual<S> d = func(Dual<S>(src[i], 1));
+                dst[i] = d.value;
+                dy[i] = d.slope;
+            }
+            return y;
+        }
+    }
+
+    template<typename T> T dual_attr_matrix
+            (bool train){
+        T ret(1, 1);
+        ret << static_cast<typename T::Scalar>(train);
+        return ret;
+    }
+
+    template<typename T, typename F>
+    [[nodiscard]] decltype(auto) unaryExpr
+            (const T &t, const DualFunction<F> &f){
+        LAZY_TYPEDEF_OPERATOR(T);
+        auto state = std::make_shared<detail::DualState<ValueType>>();
+
+        auto ret = make_operand<ValueType>();
+        ret->getPreOperand().insert({t});
+        ret->setFunction([t, f, state]() -> ValueType{
+            state->fresh = false;
+            return detail::dual_map(t->eval(), f.func, static_cast<ValueType*>(nullptr));
+        });
+
+        t->getPostOperand().insert({ret});
+        t->getDF()[ret] = [t, ret, f, state](const PtrType& E) -> ValueType{
+            if(!state->fresh){
+                detail::dual_map(t->eval(), f.func, &state->slope);
+                state->fresh = true;
+            }
+            return ret->diff(E).cwiseProduct(state->slope);
+        };
+
+        return ret;
+    }
+
+    template<typename T1, typename F, typename T2>
+    [[nodiscard]] decltype(auto) unaryExpr
+            (const T1 &t, const DualFunction<F> &f, const T2 &attr){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        auto state = std::make_shared<detail::DualState<ValueType>>();
+
+        auto ret = make_operand<ValueType>();
+        ret->getPreOperand().insert({t, attr});
+        ret->setFunction([t, f, attr, state]() -> ValueType{
+            state->fresh = attr->eval()(0) != 0;
+            return detail::dual_map(t->eval(), f.func, state->fresh ? &state->slope : nullptr);
+        });
+
+        t->getPostOperand().insert({ret});
+        t->detachValue(ret);
+        t->getDF()[ret] = [t, ret, f, state](const PtrType& E) -> ValueType{
+            if(!state->fresh){
+                detail::dual_map(t->eval(), f.func, &state->slope);
+                state->fresh = true;
+            }
+            return ret->diff(E).cwiseProduct(state->slope);
+        };
+
+        attr->getPostOperand().insert({ret});
+        // d(ret) / d(attr) is undefined
+
+        return ret;
+    }
+
+
+    /*
+     * Broadcast deltas
+     * The deltas of a bias vector's output w.r.t. its matrix, and of a reduction w.r.t. its input,
+     * are the output delta as is or stretched over the reduced axes. They are added straight into
+     * the delta cache of the input as scatter deltas (see Operand::getScatterDF), a column at a
+     * time (a column of d, or one of its values set down the column), so no stretched copy or
+     * product with a ones vector is built. A tensor cache starts as a stride-0 view of the reduced delta.
+     */
+
+    namespace detail {
+
+        // cache (+)= d : a delta passed through unchanged
+        template<typename T>
+        void scatter_delta(T& cache, bool initialized, const T& d){
+            if(initialized)
+                cache += d;
+            else
+                cache = d;
+        }
+
+        // cache (+)= d stretched to shape (d is rows x 1, 1 x cols or 1 x 1 for matrices)
+        template<typename T>
+        void scatter_broadcast(T& cache, bool initialized, const T& d, const typename value_traits<T>::Shape& shape){
+            if constexpr (is_tensor_v<T>) {
+                if(initialized)
+                    cache += d;
+                else
+                    cache = d.broadcast(shape);
+            } else {
+                // column by column : Eigen's replicate / rowwise() do not vectorize a row stretched down the columns
+                const auto [rows, cols] = shape;
+                if(!initialized)
+                    cache.resize(rows, cols);
+                for(Index j = 0; j < cols; ++j){
+                    auto col = cache.col(j);
+                    if(d.rows() == rows){
+                        if(initialized) col += d.col(d.cols() == 1 ? 0 : j);
+                        else col = d.col(d.cols() == 1 ? 0 : j);
+                    } else {
+                        const auto v = d(0, d.cols() == 1 ? 0 : j);
+                        if(initialized) col.array() += v;
+                        else col.setConstant(v);
+                    }
+                }
+            }
+        }
+    }
 
     /*
      * Plus
+     * for tensors, vec is broadcast over the other axes (no copy) and its delta is summed back
      */
 
     template<typename T1, typename T2>
@@ -65,17 +249,24 @@ namespace lazy {
         auto ret = make_operand<ValueType>();
         ret->getPreOperand().insert({t1, vec});
         ret->setFunction([t1, vec]() -> ValueType {
-            return t1->eval().colwise() + vec->eval().col(0);
+            if constexpr (is_tensor_v<ValueType>)
+                return t1->eval() + vec->eval();
+            else
+                return t1->eval().colwise() + vec->eval().col(0);
         });
 
         t1->getPostOperand().insert({ret});
-        t1->getDF()[ret] = [ret](const PtrType& E) -> ValueType {
-            return ret->diff(E);
+        t1->detachValue(ret);
+        t1->getScatterDF()[ret] = [ret](const PtrType& E, ValueType& cache, bool initialized){
+            detail::scatter_delta(cache, initialized, ret->diff(E));
         };
 
         vec->getPostOperand().insert({ret});
-        vec->getDF()[ret] = [ret](const PtrType& E) -> ValueType {
-            return ret->diff(E).rowwise().sum();
+        vec->getDF()[ret] = [vec, ret](const PtrType& E) -> ValueType {
+            if constexpr (is_tensor_v<ValueType>)
+                return ret->diff(E).sumTo(vec->eval().shape());
+            else
+                return ret->diff(E).rowwise().sum();
         };
 
         return ret;
@@ -89,17 +280,24 @@ namespace lazy {
         auto ret = make_operand<ValueType>();
         ret->getPreOperand().insert({t1, vec});
         ret->setFunction([t1, vec]() -> ValueType {
-            return t1->eval().rowwise() + vec->eval().row(0);
+            if constexpr (is_tensor_v<ValueType>)
+                return t1->eval() + vec->eval();
+            else
+                return t1->eval().rowwise() + vec->eval().row(0);
         });
 
         t1->getPostOperand().insert({ret});
-        t1->getDF()[ret] = [ret](const PtrType& E) -> ValueType {
-            return ret->diff(E);
+        t1->detachValue(ret);
+        t1->getScatterDF()[ret] = [ret](const PtrType& E, ValueType& cache, bool initialized){
+            detail::scatter_delta(cache, initialized, ret->diff(E));
         };
 
         vec->getPostOperand().insert({ret});
-        vec->getDF()[ret] = [ret](const PtrType& E) -> ValueType {
-            return ret->diff(E).colwise().sum();
+        vec->getDF()[ret] = [vec, ret](const PtrType& E) -> ValueType {
+            if constexpr (is_tensor_v<ValueType>)
+                return ret->diff(E).sumTo(vec->eval().shape());
+            else
+                return ret->diff(E).colwise().sum();
         };
 
         return ret;
@@ -131,20 +329,456 @@ namespace lazy {
                          [constant](ScalarType)->ScalarType{return constant;});
     }
 
+    namespace detail {
+
+        // axes 2.. of a tensor shape (the batch of a batched matrix product)
+        inline TensorShape batch_axes(const TensorShape& shape){
+            TensorShape ret(shape.rank() > 2 ? shape.rank() - 2 : 0, 1);
+            for(std::size_t a = 0; a < ret.rank(); ++a) ret[a] = shape[a + 2];
+            return ret;
+        }
+
+        // offset (from data()) of every matrix of t over batch, column-major; axes of extent 1 repeat
+        template<typename S>
+        std::vector<Index> batch_offsets(const Tensor<S>& t, const TensorShape& batch){
+            std::vector<Index> offsets(static_cast<std::size_t>(batch.count()));
+            TensorShape counter(batch.rank(), 0);
+            Index off = 0;
+            for(auto& o: offsets){
+                o = off;
+                for(std::size_t a = 0; a < batch.rank(); ++a){
+                    const Index stride = t.dim(a + 2) == 1 ? 0 : t.strides()[a + 2];
+                    off += stride;
+                    if(++counter[a] < batch[a]) break;
+                    off -= stride * batch[a];
+                    counter[a] = 0;
+                }
+            }
+            return offsets;
+        }
+
+        // t itself if its matrices have a unit stride along rows or columns, a packed copy otherwise
+        template<typename S>
+        Tensor<S> gemm_operand(const Tensor<S>& t){
+            const Index s0 = t.rank() > 0 ? t.strides()[0] : 1;
+            const Index s1 = t.rank() > 1 ? t.strides()[1] : 1;
+            if(s0 == 1 || s1 == 1 || t.dim(0) == 1 || t.dim(1) == 1) return t;
+            return t.contiguous();
+        }
+
+        // f(matrix) with the matrix at offset of a gemm_operand, mapped in place (transposed if it is row-major)
+        template<typename S, typename F>
+        void with_matrix(const Tensor<S>& t, Index offset, F&& f){
+            using Map = Eigen::Map<const Matrix<S>, Eigen::Unaligned, Eigen::OuterStride<>>;
+            const Index rows = t.dim(0), cols = t.dim(1);
+            const Index s0 = t.rank() > 0 ? t.strides()[0] : 1;
+            const Index s1 = t.rank() > 1 ? t.strides()[1] : rows;
+            const S* p = t.data() + offset;
+            if(s0 == 1 || rows == 1)
+                f(Map(p, rows, cols, Eigen::OuterStride<>(cols == 1 ? rows : s1)));
+            else
+                f(Map(p, cols, rows, Eigen::OuterStride<>(s0)).transpose());
+        }
+
+        template<typename S>
+        Tensor<S> batch_matrix_product(const Tensor<S>& a, const Tensor<S>& b){
+            if(a.dim(1) != b.dim(0))
+                throw std::runtime_error("lazy: batch_dot_product needs matching inner dimensions");
+            const TensorShape batch = broadcast_shape(batch_axes(a.shape()), batch_axes(b.shape()));
+            TensorShape shape(batch.rank() + 2, 1);
+            shape[0] = a.dim(0);
+            shape[1] = b.dim(1);
+            for(std::size_t i = 0; i < batch.rank(); ++i) shape[i + 2] = batch[i];
+
+            Tensor<S> ret(shape);
+            const Index m = a.dim(0), n = b.dim(1);
+            S* out = ret.data();
+
+            // one matrix for the whole batch times packed matrices : a single GEMM
+            if(a.rank() <= 2 && b.isContiguous() && batch_axes(b.shape()) == batch){
+                const Tensor<S> lhs = gemm_operand(a);
+                with_matrix(lhs, 0, [&](const auto& A){
+                    Eigen::Map<Matrix<S>>(out, m, n * batch.count()).noalias()
+                            = A * Eigen::Map<const Matrix<S>>(b.data(), b.dim(0), n * batch.count());
+                });
+                return ret;
+            }
+
+            const Tensor<S> lhs = gemm_operand(a), rhs = gemm_operand(b);
+            const auto la = batch_offsets(lhs, batch), lb = batch_offsets(rhs, batch);
+            for(std::size_t i = 0; i < la.size(); ++i){
+                with_matrix(lhs, la[i], [&](const auto& A){
+                    with_matrix(rhs, lb[i], [&](const auto& B){
+                        Eigen::Map<Matrix<S>>(out + static_cast<Index>(i) * m * n, m, n).noalias() = A * B;
+                    });
+                });
+            }
+            return ret;
+        }
+    }
+
+    /*
+     * batch_dot_product(t1, t2) : matrix products of tensors over their two leading axes
+     * t1 {m, k, batch...} x t2 {k, n, batch...} -> {m, n, batch...}
+     * The batch axes broadcast, so a rank-2 t1 is one matrix (e.g. shared weights) for every item.
+     * Transposed views are read in place by the GEMM; a rank-2 t1 times a packed t2 is one GEMM
+     * over the whole batch, in both directions.
+     */
+
     template<typename T1, typename T2>
-    [[nodiscard]] decltype(auto) dot_product
+    [[nodiscard]] decltype(auto) batch_dot_product
             (const T1 &t1, const T2 &t2){
         LAZY_TYPEDEF_OPERATOR(T1);
+        static_assert(is_tensor_v<ValueType>, "lazy: batch_dot_product needs tensor operands");
 
         auto ret = make_operand<ValueType>();
         ret->getPreOperand().insert({t1, t2});
         ret->setFunction([t1, t2]() -> ValueType {
-            return t1->eval() * t2->eval();
+            return detail::batch_matrix_product(t1->eval(), t2->eval());
         });
 
+        // dt1 = dout * t2^T and dt2 = t1^T * dout, summed over the items t1 / t2 were broadcast to
         t1->getPostOperand().insert({ret});
-        t1->getDF()[ret] = [t2, ret](const PtrType& E) -> ValueType {
-            return ret->diff(E) * t2->eval().transpose();
+        t1->getDF()[ret] = [t1, t2, ret](const PtrType& E) -> ValueType {
+            const auto& a = t1->eval();
+            const auto& b = t2->eval();
+            const ValueType d = ret->diff(E).contiguous();
+
+            if(a.rank() <= 2 && b.isContiguous()){
+                // all the items side by side : (m x n*batch) * (n*batch x k)
+                const Index m = d.dim(0), k = b.dim(0), cols = d.size() / std::max<Index>(m, 1);
+                if(b.size() == k * cols){
+                    ValueType da(a.shape());
+                    Eigen::Map<Matrix<ScalarType>>(da.data(), m, k).noalias()
+                            = Eigen::Map<const Matrix<ScalarType>>(d.data(), m, cols)
+                            * Eigen::Map<const Matrix<ScalarType>>(b.data(), k, cols).transpose();
+                    return da;
+                }
+            }
+            return detail::batch_matrix_product(d, b.transpose()).sumTo(a.shape());
+        };
+
+        t2->getPostOperand().insert({ret});
+        t2->getDF()[ret] = [t1, t2, ret](const PtrType& E) -> ValueType {
+            const auto& a = t1->eval();
+            const auto& b = t2->eval();
+            return detail::batch_matrix_product(a.transpose(), ret->diff(E)).sumTo(b.shape());
+        };
+
+        return ret;
+    }
+
+    namespace detail {
+
+        // delta of W in W * x for a sparse x : the columns of the features present in x, appended to out
+        template<typename S, typename SparseType>
+        void sparse_weight_delta(const Matrix<S>& d, const SparseType& x, ColumnDelta<Matrix<S>>& out){
+            // the non-zeros by feature, as (feature << 32 | position) keys (sorting them costs less
+            // than a pass over every feature, and integers sort faster than entries)
+            std::vector<std::uint64_t> keys;
+            std::vector<Index> samples;
+            std::vector<S> values;
+            keys.reserve(static_cast<std::size_t>(x.nonZeros()));
+            for(Index k = 0; k < x.outerSize(); ++k){
+                for(typename SparseType::InnerIterator it(x, k); it; ++it){
+                    keys.push_back((static_cast<std::uint64_t>(it.row()) << 32) | samples.size());
+                    samples.push_back(it.col());
+                    values.push_back(it.value());
+                }
+            }
+            std::sort(keys.begin(), keys.end());
+
+            const auto first = static_cast<Index>(out.columns.size());
+            std::vector<std::size_t> starts;
+            for(std::size_t e = 0; e < keys.size(); ++e){
+                if(e == 0 || (keys[e] >> 32) != (keys[e - 1] >> 32)){
+                    starts.push_back(e);
+                    out.columns.push_back(static_cast<Index>(keys[e] >> 32));
+                }
+            }
+            starts.push_back(keys.size());
+
+            const auto n = static_cast<Index>(starts.size() - 1);
+            out.values.conservativeResize(d.rows(), first + n);
+
+            #pragma omp parallel for schedule(static) if(n * d.rows() > 65536)
+            for(Index k = 0; k < n; ++k){
+                auto column = out.values.col(first + k);
+                column.setZero();
+                for(std::size_t e = starts[k]; e < starts[k + 1]; ++e){
+                    const auto i = static_cast<std::size_t>(keys[e] & 0xFFFFFFFFu);
+                    column += values[i] * d.col(samples[i]);
+                }
+            }
+        }
+    }
+
+    /*
+     * dot_product with a sparse input (e.g. a Placeholder<SparseMatrix<S>>), in time proportional to its non-zeros
+     *   W * x : x features x batch; the delta of W covers the columns of the features present in x only,
+     *           and is also given as a column delta (see Operand::diffColumns), so the optimizers
+     *           update those columns alone
+     *   a * h : a sparse (e.g. an adjacency matrix); the delta of h is a^T * dout
+     * The sparse operand is not in the graph of the dense values and gets no delta.
+     */
+
+    template<typename T1, typename T2>
+    [[nodiscard]] decltype(auto) sparse_dot_product
+            (const T1 &t1, const T2 &t2){
+        using V1 = typename T1::element_type::ValueType;
+        using V2 = typename T2::element_type::ValueType;
+        static_assert(std::is_same_v<typename V1::Scalar, typename V2::Scalar>, "lazy: Types are inconsistent");
+
+        if constexpr (is_sparse_v<V2>) {
+            using ValueType = V1;
+            using PtrType = typename Operand<ValueType>::Pointer;
+
+            auto ret = make_operand<ValueType>();
+            ret->getPreOperand().insert({t1});
+            ret->setFunction([t1, t2]() -> ValueType {
+                return t1->eval() * t2->eval();
+            });
+
+            auto columns = [t2, ret](const PtrType& E, ColumnDelta<ValueType>& out){
+                detail::sparse_weight_delta(ret->diff(E), t2->eval(), out);
+            };
+
+            t1->getPostOperand().insert({ret});
+            t1->detachValue(ret);
+            t1->getScatterDF()[ret] = [t2, columns](const PtrType& E, ValueType& cache, bool initialized){
+                ColumnDelta<ValueType> d;
+                columns(E, d);
+                if(!initialized) cache = ValueType::Zero(d.values.rows(), t2->eval().rows());
+                for(std::size_t k = 0; k < d.columns.size(); ++k) cache.col(d.columns[k]) += d.values.col(static_cast<Index>(k));
+            };
+            t1->getColumnDF()[ret] = columns;
+
+            // t2 is not in the graph of ValueType; feeding it resets ret through a link
+            link_operand(typename T2::element_type::Pointer(t2), PtrType(ret));
+            return ret;
+        } else {
+            using ValueType = V2;
+            using PtrType = typename Operand<ValueType>::Pointer;
+
+            auto ret = make_operand<ValueType>();
+            ret->getPreOperand().insert({t2});
+            ret->setFunction([t1, t2]() -> ValueType {
+                return t1->eval() * t2->eval();
+            });
+
+            t2->getPostOperand().insert({ret});
+            t2->detachValue(ret);
+            t2->getDF()[ret] = [t1, ret](const PtrType& E) -> ValueType {
+                return t1->eval().transpose() * ret->diff(E);
+            };
+
+            link_operand(typename T1::element_type::Pointer(t1), PtrType(ret));
+            return ret;
+        }
+    }
+
+    template<typename T1, typename T2>
+    [[nodiscard]] decltype(auto) dot_product
+            (const T1 &t1, const T2 &t2){
+        LAZY_TYPEDEF_OPERATOR(T1);
+
+        // tensors : the rank-2 case of batch_dot_product
+        if constexpr (is_tensor_v<ValueType>) {
+            return batch_dot_product(t1, t2);
+        } else if constexpr (is_sparse_v<ValueType> || is_sparse_v<typename T2::element_type::ValueType>) {
+            return sparse_dot_product(t1, t2);
+        } else {
+            auto ret = make_operand<ValueType>();
+            ret->getPreOperand().insert({t1, t2});
+            ret->setFunction([t1, t2]() -> ValueType {
+                return t1->eval() * t2->eval();
+            });
+
+            t1->getPostOperand().insert({ret});
+            t1->getDF()[ret] = [t2, ret](const PtrType& E) -> ValueType {
+                return ret->diff(E) * t2->eval().transpose();
+            };
+
+            t2->getPostOperand().insert({ret});
+            t2->getDF()[ret] = [t1, ret](const PtrType& E) -> ValueType {
+                return t1->eval().transpose() * ret->diff(E);
+            };
+
+            return ret;
+        }
+    }
+
+    /*
+     * dot_product(t1, t2, scale) = t1 * (scale * t2) for an integer input t2 (e.g. raw uint8 pixels)
+     * t2 is converted one panel of columns at a time inside the product and scale is
+     * folded into it, so no converted copy of t2 is kept; t2 gets no delta.
+     */
+
+    template<typename T1, typename T2,
+            typename = std::enable_if_t<std::is_integral_v<typename T2::element_type::ValueType::Scalar>>>
+    [[nodiscard]] decltype(auto) dot_product
+            (const T1 &t1, const T2 &t2, typename T1::element_type::ValueType::Scalar scale){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        using InputType = typename T2::element_type::ValueType;
+
+        // columns converted at once (784 x 64 floats stay in L2)
+        static constexpr Index panel_cols = 64;
+
+        auto ret = make_operand<ValueType>();
+        ret->getPreOperand().insert({t1});
+        ret->setFunction([t1, t2, scale]() -> ValueType {
+            const auto& w = t1->eval();
+            const InputType& x = t2->eval();
+
+            ValueType out(w.rows(), x.cols());
+            ValueType panel;
+            for(Index j = 0; j < x.cols(); j += panel_cols){
+                const Index n = std::min(panel_cols, x.cols() - j);
+                panel = x.middleCols(j, n).template cast<ScalarType>();
+                out.middleCols(j, n).noalias() = scale * (w * panel);
+            }
+            return out;
+        });
+
+        t1->getPostOperand().insert({ret});
+        t1->getDF()[ret] = [t2, ret, scale](const PtrType& E) -> ValueType {
+            const auto& d = ret->diff(E);
+            const InputType& x = t2->eval();
+
+            ValueType dw(d.rows(), x.rows());
+            ValueType panel;
+            for(Index j = 0; j < x.cols(); j += panel_cols){
+                const Index n = std::min(panel_cols, x.cols() - j);
+                panel = x.middleCols(j, n).template cast<ScalarType>();
+                if(j == 0){
+                    dw.noalias() = scale * (d.middleCols(j, n) * panel.transpose());
+                } else {
+                    dw.noalias() += scale * (d.middleCols(j, n) * panel.transpose());
+                }
+            }
+            if(x.cols() == 0) dw.setZero();
+            return dw;
+        };
+
+        // t2 is not in the graph of ValueType; feeding it resets ret through a link
+        link_operand(typename T2::element_type::Pointer(t2), PtrType(ret));
+
+        return ret;
+    }
+
+    /*
+     * ActivationSparsity : opt-in switch of dot_product(W, x, sparsity) on the zeros of x
+     * (e.g. x after relu or dropout), decided at every forward pass from one counting pass over x :
+     *   sparse    : at most threshold of x is non-zero; W * x and dW = d * x^T go through x as a
+     *               sparse matrix, in time proportional to its non-zeros
+     *   compacted : at least zero_rows of the rows of x are all zero (dead units); the products
+     *               skip those rows of x and columns of W, and dW gets zero columns for them
+     *   dense     : the usual GEMMs
+     * dx = W^T * d is always dense. The counters tell how often each path was taken.
+     * With 1024 x 1024 W and 100 columns, the sparse path is faster below about 10% non-zeros.
+     */
+
+    struct ActivationSparsity {
+        double threshold = 0.1;
+        double zero_rows = 0.125;
+
+        std::atomic<std::size_t> dense{0};
+        std::atomic<std::size_t> sparse{0};
+        std::atomic<std::size_t> compacted{0};
+        std::atomic<double> density{1};     // non-zero fraction of the last x
+    };
+
+    inline std::shared_ptr<ActivationSparsity> make_activation_sparsity(double threshold = 0.1, double zero_rows = 0.125){
+        auto ret = std::make_shared<ActivationSparsity>();
+        ret->threshold = threshold;
+        ret->zero_rows = zero_rows;
+        return ret;
+    }
+
+    namespace detail {
+        // x of the last forward pass, in the form the path used
+        template<typename S>
+        struct SparsityState {
+            enum class path { dense, sparse, compacted } mode = path::dense;
+            SparseMatrix<S> sparse;
+            Matrix<S> compacted;
+            std::vector<Index> live;    // non-zero rows of x (compacted)
+        };
+    }
+
+    template<typename T1, typename T2>
+    [[nodiscard]] decltype(auto) dot_product
+            (const T1 &t1, const T2 &t2, const std::shared_ptr<ActivationSparsity>& sparsity){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        static_assert(value_traits<ValueType>::column_deltas, "lazy: activation sparsity needs matrix operands");
+        using State = detail::SparsityState<ScalarType>;
+        auto state = std::make_shared<State>();
+
+        auto ret = make_operand<ValueType>();
+        ret->getPreOperand().insert({t1, t2});
+        ret->setFunction([t1, t2, sparsity, state]() -> ValueType {
+            const auto& w = t1->eval();
+            const auto& x = t2->eval();
+
+            // non-zeros per row
+            std::vector<Index> counts(static_cast<std::size_t>(x.rows()), 0);
+            Index nnz = 0;
+            for(Index j = 0; j < x.cols(); ++j){
+                for(Index i = 0; i < x.rows(); ++i) counts[i] += x(i, j) != ScalarType(0);
+            }
+            state->live.clear();
+            for(Index i = 0; i < x.rows(); ++i){
+                nnz += counts[i];
+                if(counts[i] > 0) state->live.push_back(i);
+            }
+            const double density = x.size() > 0 ? double(nnz) / double(x.size()) : 1.0;
+            const auto dead = static_cast<double>(x.rows() - static_cast<Index>(state->live.size()));
+            sparsity->density = density;
+
+            ValueType out;
+            if(density <= sparsity->threshold){
+                state->mode = State::path::sparse;
+                state->sparse = x.sparseView();
+                out.noalias() = w * state->sparse;
+                ++sparsity->sparse;
+            } else if(dead >= sparsity->zero_rows * double(x.rows())){
+                state->mode = State::path::compacted;
+                const auto live = static_cast<Index>(state->live.size());
+                ValueType wc(w.rows(), live);
+                state->compacted.resize(live, x.cols());
+                for(Index k = 0; k < live; ++k) wc.col(k) = w.col(state->live[k]);
+                for(Index j = 0; j < x.cols(); ++j){
+                    for(Index k = 0; k < live; ++k) state->compacted(k, j) = x(state->live[k], j);
+                }
+                out.noalias() = wc * state->compacted;
+                ++sparsity->compacted;
+            } else {
+                state->mode = State::path::dense;
+                out.noalias() = w * x;
+                ++sparsity->dense;
+            }
+            return out;
+        });
+
+        t1->getPostOperand().insert({ret});
+        t1->getDF()[ret] = [t2, ret, state](const PtrType& E) -> ValueType {
+            const auto& d = ret->diff(E);
+            const auto& x = t2->eval();
+            switch(state->mode){
+                case State::path::sparse: {
+                    ValueType dw;
+                    dw.noalias() = d * state->sparse.transpose();
+                    return dw;
+                }
+                case State::path::compacted: {
+                    const ValueType dwc = d * state->compacted.transpose();
+                    ValueType dw = ValueType::Zero(d.rows(), x.rows());
+                    for(std::size_t k = 0; k < state->live.size(); ++k) dw.col(state->live[k]) = dwc.col(static_cast<Index>(k));
+                    return dw;
+                }
+                default:
+                    return d * x.transpose();
+            }
         };
 
         t2->getPostOperand().insert({ret});
@@ -179,6 +813,262 @@ namespace lazy {
         return ret;
     }
 
+    /*
+     * Structure : slice / concat / transpose / reshape (/ permute for tensors)
+     * axis 0 is the rows and 1 the columns of a matrix (axis 0 is the fastest of a tensor).
+     * On tensors the results are views of the input storage and no element is copied;
+     * matrices own their elements, so they copy the block (contiguous columns at most).
+     * Backward scatters each delta into its block of the input delta
+     * instead of building a full-size zero matrix per slice.
+     */
+
+    namespace detail {
+
+        template<typename T>
+        Index axis_extent(const T& x, Index axis){
+            if constexpr (is_tensor_v<T>)
+                return x.dim(static_cast<std::size_t>(axis));
+            else
+                return axis == 0 ? x.rows() : x.cols();
+        }
+
+        // elements [begin, begin + length) of axis
+        template<typename T>
+        T block(const T& x, Index axis, Index begin, Index length){
+            if constexpr (is_tensor_v<T>) {
+                return x.slice(static_cast<std::size_t>(axis), begin, length);
+            } else {
+                if(axis < 0 || axis > 1 || begin < 0 || length < 0 || begin + length > axis_extent(x, axis))
+                    throw std::runtime_error("lazy: slice out of range");
+                return axis == 0 ? T(x.middleRows(begin, length)) : T(x.middleCols(begin, length));
+            }
+        }
+
+        template<typename T>
+        void assign_block(T& x, Index axis, Index begin, const T& b){
+            if constexpr (is_tensor_v<T>)
+                x.assignSlice(static_cast<std::size_t>(axis), begin, b);
+            else if(axis == 0)
+                x.middleRows(begin, b.rows()) = b;
+            else
+                x.middleCols(begin, b.cols()) = b;
+        }
+
+        template<typename T>
+        void add_block(T& x, Index axis, Index begin, const T& b){
+            if constexpr (is_tensor_v<T>)
+                x.addSlice(static_cast<std::size_t>(axis), begin, b);
+            else if(axis == 0)
+                x.middleRows(begin, b.rows()) += b;
+            else
+                x.middleCols(begin, b.cols()) += b;
+        }
+
+        template<typename T>
+        T reshaped(const T& x, const typename value_traits<T>::Shape& shape){
+            if constexpr (is_tensor_v<T>) {
+                return x.reshape(shape);
+            } else {
+                if(shape.first * shape.second != x.size())
+                    throw std::runtime_error("lazy: reshape does not keep the number of elements");
+                return Eigen::Map<const T>(x.data(), shape.first, shape.second);
+            }
+        }
+    }
+
+    template<typename T>
+    [[nodiscard]] decltype(auto) slice
+            (const T& t, Index axis, Index begin, Index length){
+        LAZY_TYPEDEF_OPERATOR(T);
+        using Shape = typename value_traits<ValueType>::Shape;
+
+        // shape of t, so the backward pass does not keep t alive
+        auto shape = std::make_shared<Shape>();
+
+        auto ret = make_operand<ValueType>();
+        ret->getPreOperand().insert({t});
+        ret->setFunction([t, axis, begin, length, shape]() -> ValueType {
+            const auto& x = t->eval();
+            *shape = value_traits<ValueType>::shape(x);
+            return detail::block(x, axis, begin, length);
+        });
+
+        t->getPostOperand().insert({ret});
+        t->detachValue(ret);
+        t->getScatterDF()[ret] = [ret, axis, begin, shape](const PtrType& E, ValueType& cache, bool initialized){
+            // (the delta first : it runs the forward pass that records the shape)
+            const auto& d = ret->diff(E);
+            if(!initialized) cache = value_traits<ValueType>::zeros(*shape);
+            detail::add_block(cache, axis, begin, d);
+        };
+
+        return ret;
+    }
+
+    template<typename T>
+    [[nodiscard]] decltype(auto) concat
+            (const std::vector<T>& ts, Index axis){
+        LAZY_TYPEDEF_OPERATOR(T);
+        if(ts.empty())
+            throw std::runtime_error("lazy: concat needs at least one operand");
+
+        // first index of every operand along axis (and the total), from the forward pass
+        auto offsets = std::make_shared<std::vector<Index>>(ts.size() + 1, 0);
+
+        auto ret = make_operand<ValueType>();
+        ret->setFunction([ts, axis, offsets]() -> ValueType {
+            auto shape = value_traits<ValueType>::shape(ts[0]->eval());
+            if constexpr (is_tensor_v<ValueType>) {
+                if(axis < 0 || static_cast<std::size_t>(axis) >= shape.rank())
+                    throw std::runtime_error("lazy: concat axis out of range");
+            } else {
+                if(axis < 0 || axis > 1)
+                    throw std::runtime_error("lazy: concat axis out of range");
+            }
+            for(std::size_t i = 0; i < ts.size(); ++i){
+                const auto& x = ts[i]->eval();
+                (*offsets)[i + 1] = (*offsets)[i] + detail::axis_extent(x, axis);
+
+                // every other extent must match the first operand
+                auto other = value_traits<ValueType>::shape(x);
+                if constexpr (is_tensor_v<ValueType>) {
+                    other[static_cast<std::size_t>(axis)] = shape[static_cast<std::size_t>(axis)];
+                } else {
+                    (axis == 0 ? other.first : other.second) = axis == 0 ? shape.first : shape.second;
+                }
+                if(other != shape)
+                    throw std::runtime_error("lazy: concat needs equal extents off the axis");
+            }
+            if constexpr (is_tensor_v<ValueType>)
+                shape[static_cast<std::size_t>(axis)] = offsets->back();
+            else
+                (axis == 0 ? shape.first : shape.second) = offsets->back();
+
+            ValueType out;
+            value_traits<ValueType>::resize(out, shape);
+            for(std::size_t i = 0; i < ts.size(); ++i)
+                detail::assign_block(out, axis, (*offsets)[i], ts[i]->eval());
+            return out;
+        });
+
+        for(const auto& t: ts){
+            if(t->getPostOperand().count(ret)) continue;
+            ret->getPreOperand().insert({t});
+            t->getPostOperand().insert({ret});
+            t->detachValue(ret);
+
+            // the blocks of every position t is given at
+            std::vector<std::size_t> positions;
+            for(std::size_t i = 0; i < ts.size(); ++i)
+                if(ts[i] == t) positions.push_back(i);
+
+            t->getDF()[ret] = [ret, axis, offsets, positions](const PtrType& E) -> ValueType {
+                const auto& d = ret->diff(E);
+                const auto block = [&](std::size_t i){
+                    return detail::block(d, axis, (*offsets)[i], (*offsets)[i + 1] - (*offsets)[i]);
+                };
+                ValueType dt = block(positions[0]);
+                for(std::size_t k = 1; k < positions.size(); ++k) dt += block(positions[k]);
+                return dt;
+            };
+        }
+
+        return ret;
+    }
+
+    template<typename T1, typename T2>
+    [[nodiscard]] decltype(auto) concat
+            (const T1& t1, const T2& t2, Index axis){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        return concat(std::vector<PtrType>{t1, t2}, axis);
+    }
+
+    template<typename T>
+    [[nodiscard]] decltype(auto) transpose
+            (const T& t){
+        LAZY_TYPEDEF_OPERATOR(T);
+        using Shape = typename value_traits<ValueType>::Shape;
+
+        auto shape = std::make_shared<Shape>();
+
+        auto ret = make_operand<ValueType>();
+        ret->getPreOperand().insert({t});
+        ret->setFunction([t, shape]() -> ValueType {
+            const auto& x = t->eval();
+            *shape = value_traits<ValueType>::shape(x);
+            return x.transpose();
+        });
+
+        t->getPostOperand().insert({ret});
+        t->detachValue(ret);
+        t->getDF()[ret] = [ret, shape](const PtrType& E) -> ValueType {
+            if constexpr (is_tensor_v<ValueType>) {
+                // a vector {n} was viewed as {1, n}
+                ValueType d = ret->diff(E).transpose();
+                return d.rank() == shape->rank() ? d : d.reshape(*shape);
+            } else {
+                return ret->diff(E).transpose();
+            }
+        };
+
+        return ret;
+    }
+
+    // shape is {rows, cols} for matrices (column-major order, like Eigen's Map)
+    template<typename T>
+    [[nodiscard]] decltype(auto) reshape
+            (const T& t, const typename value_traits<typename T::element_type::ValueType>::Shape& shape){
+        LAZY_TYPEDEF_OPERATOR(T);
+        using Shape = typename value_traits<ValueType>::Shape;
+
+        auto from = std::make_shared<Shape>();
+
+        auto ret = make_operand<ValueType>();
+        ret->getPreOperand().insert({t});
+        ret->setFunction([t, shape, from]() -> ValueType {
+            const auto& x = t->eval();
+            *from = value_traits<ValueType>::shape(x);
+            return detail::reshaped(x, shape);
+        });
+
+        t->getPostOperand().insert({ret});
+        t->detachValue(ret);
+        t->getDF()[ret] = [ret, from](const PtrType& E) -> ValueType {
+            return detail::reshaped(ret->diff(E), *from);
+        };
+
+        return ret;
+    }
+
+    // axis i of the result is axis axes[i] of t (tensors only)
+    template<typename T>
+    [[nodiscard]] decltype(auto) permute
+            (const T& t, const TensorShape& axes){
+        LAZY_TYPEDEF_OPERATOR(T);
+        static_assert(is_tensor_v<ValueType>, "lazy: permute needs a tensor operand");
+
+        TensorShape inverse(axes.rank(), 0);
+        for(std::size_t a = 0; a < axes.rank(); ++a){
+            if(axes[a] < 0 || static_cast<std::size_t>(axes[a]) >= axes.rank())
+                throw std::runtime_error("lazy: permute needs a permutation of the axes");
+            inverse[static_cast<std::size_t>(axes[a])] = static_cast<Index>(a);
+        }
+
+        auto ret = make_operand<ValueType>();
+        ret->getPreOperand().insert({t});
+        ret->setFunction([t, axes]() -> ValueType {
+            return t->eval().permute(axes);
+        });
+
+        t->getPostOperand().insert({ret});
+        t->detachValue(ret);
+        t->getDF()[ret] = [ret, inverse](const PtrType& E) -> ValueType {
+            return ret->diff(E).permute(inverse);
+        };
+
+        return ret;
+    }
+
     /*
      * reduction functions
      */
@@ -189,34 +1079,49 @@ namespace lazy {
         scalar
     };
 
+    // shape of a tensor reduction : column keeps axis 0, row sums axis 0 away, scalar is rank 0
+    inline TensorShape reduced_shape(const TensorShape& shape, reduce_to axis){
+        if(axis == reduce_to::scalar) return {};
+
+        TensorShape ret = shape;
+        for(std::size_t a = 0; a < ret.rank(); ++a){
+            if((a == 0) == (axis == reduce_to::row)) ret[a] = 1;
+        }
+        return ret;
+    }
+
+    // the backward passes read only the shape of t, so the value of t is released after the forward pass
+
     template<typename T>
     [[nodiscard]] decltype(auto) reduce_sum
             (const T& t, reduce_to axis = reduce_to::scalar){
         LAZY_TYPEDEF_OPERATOR(T);
+        using Shape = typename value_traits<ValueType>::Shape;
+
+        auto shape = std::make_shared<Shape>();
 
         auto ret = make_operand<ValueType>();
         ret->getPreOperand().insert({t});
-        ret->setFunction([t, axis]() -> ValueType {
-            if(axis == reduce_to::column)
-                return t->eval().rowwise().sum();
-            else if(axis == reduce_to::row)
-                return t->eval().colwise().sum();
-
-            ValueType m(1, 1);
-            m << t->eval().sum();
-            return m;
+        ret->setFunction([t, axis, shape]() -> ValueType {
+            const auto& x = t->eval();
+            *shape = value_traits<ValueType>::shape(x);
+            if constexpr (is_tensor_v<ValueType>){
+                return x.sumTo(reduced_shape(x.shape(), axis));
+            } else {
+                if(axis == reduce_to::column)
+                    return x.rowwise().sum();
+                else if(axis == reduce_to::row)
+                    return x.colwise().sum();
+
+                return value_traits<ValueType>::scalar(x.sum());
+            }
         });
 
         t->getPostOperand().insert({ret});
-        t->getDF()[ret] = [t, ret, axis](const PtrType& E) -> ValueType {
-            const auto rows = t->eval().rows();
-            const auto cols = t->eval().cols();
-            if(axis == reduce_to::column)
-                return ret->diff(E) * ValueType::Ones(1, cols);
-            else if(axis == reduce_to::row)
-                return ValueType::Ones(rows, 1) * ret->diff(E);
-
-            return ValueType::Constant(rows, cols, ret->diff(E)(0,0));
+        t->detachValue(ret);
+        t->getScatterDF()[ret] = [ret, shape](const PtrType& E, ValueType& cache, bool initialized){
+            const auto& d = ret->diff(E);
+            detail::scatter_broadcast(cache, initialized, d, *shape);
         };
 
         return ret;
@@ -226,29 +1131,40 @@ namespace lazy {
     [[nodiscard]] decltype(auto) reduce_mean
             (const T& t, reduce_to axis = reduce_to::scalar){
         LAZY_TYPEDEF_OPERATOR(T);
+        using Shape = typename value_traits<ValueType>::Shape;
+
+        auto shape = std::make_shared<Shape>();
+
         auto ret = make_operand<ValueType>();
         ret->getPreOperand().insert({t});
-        ret->setFunction([t, axis]() -> ValueType {
-            if(axis == reduce_to::column)
-                return t->eval().rowwise().mean();
-            else if(axis == reduce_to::row)
-                return t->eval().colwise().mean();
-
-            ValueType m(1, 1);
-            m << t->eval().mean();
-            return m;
+        ret->setFunction([t, axis, shape]() -> ValueType {
+            const auto& x = t->eval();
+            *shape = value_traits<ValueType>::shape(x);
+            if constexpr (is_tensor_v<ValueType>){
+                const TensorShape reduced = reduced_shape(x.shape(), axis);
+                return x.sumTo(reduced) / ScalarType(x.size() / std::max<Index>(reduced.count(), 1));
+            } else {
+                if(axis == reduce_to::column)
+                    return x.rowwise().mean();
+                else if(axis == reduce_to::row)
+                    return x.colwise().mean();
+
+                return value_traits<ValueType>::scalar(x.mean());
+            }
         });
 
         t->getPostOperand().insert({ret});
-        t->getDF()[ret] = [t, ret, axis](const PtrType& E) -> ValueType {
-            const auto rows = t->eval().rows();
-            const auto cols = t->eval().cols();
-            if(axis == reduce_to::column)
-                return ret->diff(E) * ValueType::Constant(1, cols, 1 / ScalarType(cols));
-            else if(axis == reduce_to::row)
-                return ValueType::Constant(rows, 1, 1 / ScalarType(rows)) * ret->diff(E);
-
-            return ValueType::Constant(rows, cols, ret->diff(E)(0,0) / ScalarType(rows*cols));
+        t->detachValue(ret);
+        t->getScatterDF()[ret] = [ret, shape](const PtrType& E, ValueType& cache, bool initialized){
+            const auto& d = ret->diff(E);
+            // each element of d is the mean of size / d.size() elements (d is the small side)
+            Index count;
+            if constexpr (is_tensor_v<ValueType>)
+                count = shape->count();
+            else
+                count = shape->first * shape->second;
+            const ValueType scaled = d * (ScalarType(1) / ScalarType(count / std::max<Index>(d.size(), 1)));
+            detail::scatter_broadcast(cache, initialized, scaled, *shape);
         };
 
         return ret;
@@ -0,0 +1,398 @@
+#ifndef LAZYDEEP1_RECURRENT_HPP
+#define LAZYDEEP1_RECURRENT_HPP
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include "Kernel.hpp"
+#include "Functor.hpp"
+
+namespace lazy::nn {
+
+    /*
+     * Packed sequences
+     *
+     * A batch of sequences of different lengths is stored step by step, without padding:
+     * the columns of step t are the sequences still running at t, so the lengths must be in
+     * decreasing order. Sequence i at step t is column offsets[t] + i (i < batch_sizes[t]).
+     * Recurrent operators take the lengths as a 1 x batch operand (a placeholder fed per batch),
+     * so one graph serves every batch.
+     */
+
+    struct PackedSequence {
+        std::vector<Index> lengths;
+        std::vector<Index> batch_sizes;     // sequences running at each step
+        std::vector<Index> offsets;         // first column of each step
+        Index total = 0;                    // number of columns
+
+        template<typename T>
+        static PackedSequence fromLengths(const T& lengths){
+            PackedSequence seq;
+            for(Index i = 0; i < lengths.size(); ++i){
+                const auto len = static_cast<Index>(lengths(i));
+                if(len <= 0 || (i > 0 && len > seq.lengths.back()))
+                    throw std::runtime_error("lazy: sequence lengths must be positive and in decreasing order");
+                seq.lengths.push_back(len);
+            }
+
+            const Index steps = seq.lengths.empty() ? 0 : seq.lengths.front();
+            Index running = static_cast<Index>(seq.lengths.size());
+            for(Index t = 0; t < steps; ++t){
+                while(running > 0 && seq.lengths[running - 1] <= t) --running;
+                seq.offsets.push_back(seq.total);
+                seq.batch_sizes.push_back(running);
+                seq.total += running;
+            }
+            return seq;
+        }
+
+        Index batch() const noexcept {
+            return static_cast<Index>(lengths.size());
+        }
+
+        Index steps() const noexcept {
+            return static_cast<Index>(batch_sizes.size());
+        }
+    };
+
+    // padded : features x (steps * batch), step by step (column t * batch + i) -> packed
+    template<typename T>
+    T pack_sequences(const T& padded, const PackedSequence& seq){
+        T ret(padded.rows(), seq.total);
+        for(Index t = 0; t < seq.steps(); ++t)
+            ret.middleCols(seq.offsets[t], seq.batch_sizes[t]) = padded.middleCols(t * seq.batch(), seq.batch_sizes[t]);
+        return ret;
+    }
+
+    // packed -> padded (zeros after the end of each sequence)
+    template<typename T>
+    T unpack_sequences(const T& packed, const PackedSequence& seq){
+        T ret = T::Zero(packed.rows(), seq.steps() * seq.batch());
+        for(Index t = 0; t < seq.steps(); ++t)
+            ret.middleCols(t * seq.batch(), seq.batch_sizes[t]) = packed.middleCols(seq.offsets[t], seq.batch_sizes[t]);
+        return ret;
+    }
+
+    namespace detail {
+
+        /*
+         * Recurrent cells over packed sequences
+         *
+         * The input projection W * x + b of every step is one GEMM over all the columns;
+         * each step then adds U * h (all gates stacked, one GEMM) and applies the gate math
+         * column by column. The gate activations are kept for the backward pass (BPTT),
+         * which walks the steps back with one U^T GEMM per step and takes dW, dU and db
+         * as single GEMMs over all the steps at the end.
+         * A step reads the first batch_sizes[t] columns of the previous one (lengths are sorted).
+         */
+
+        template<typename S>
+        struct RecurrentState {
+            Matrix<S> gates;        // activated gates of every column
+            Matrix<S> aux;          // LSTM : cell state, GRU : U_n * h
+            Matrix<S> dgates;       // backward scratch
+            Matrix<S> dhidden;      // GRU : deltas of U * h
+            Matrix<S> carry;        // deltas flowing to the previous step
+            Matrix<S> carry_cell;
+            Matrix<S> previous;     // h of the previous step of every column (steps >= 1)
+            PackedSequence seq;
+        };
+
+        // h of the previous step for the columns of steps >= 1
+        template<typename S>
+        void previous_hidden(const Matrix<S>& h, const PackedSequence& seq, Matrix<S>& prev){
+            const Index first = seq.batch_sizes.empty() ? 0 : seq.batch_sizes[0];
+            prev.resize(h.rows(), seq.total - first);
+            for(Index t = 1; t < seq.steps(); ++t)
+                prev.middleCols(seq.offsets[t] - first, seq.batch_sizes[t]) = h.middleCols(seq.offsets[t - 1], seq.batch_sizes[t]);
+        }
+
+        // dW = dg x^T, dU = dh prev^T, db = sum of dg, dx = W^T dg
+        template<typename S>
+        void recurrent_weight_deltas(const Matrix<S>& x, const Matrix<S>& w, const Matrix<S>& h, const Matrix<S>& dg,
+                const Matrix<S>& dh, RecurrentState<S>& st, Matrix<S>* dx, Matrix<S>* dw, Matrix<S>* du, Matrix<S>* db){
+            if(dw) dw->noalias() = dg * x.transpose();
+            if(du){
+                const Index first = st.seq.batch_sizes.empty() ? 0 : st.seq.batch_sizes[0];
+                previous_hidden(h, st.seq, st.previous);
+                du->noalias() = dh.rightCols(st.seq.total - first) * st.previous.transpose();
+            }
+            if(db){
+                db->setZero(dg.rows(), 1);
+                for(Index c = 0; c < dg.cols(); ++c) *db += dg.col(c);
+            }
+            if(dx) dx->noalias() = w.transpose() * dg;
+        }
+
+        // gates i, f, g, o (rows [0, H), [H, 2H), [2H, 3H), [3H, 4H) of W, U and b)
+        template<typename S>
+        struct Lstm {
+            using MatrixType = Matrix<S>;
+
+            static void forward(const MatrixType& x, const MatrixType& w, const MatrixType& u, const MatrixType& b,
+                    RecurrentState<S>& st, MatrixType& h){
+                const auto& seq = st.seq;
+                const Index H = u.cols();
+                auto& a = st.gates;
+                auto& c = st.aux;
+                c.resize(H, seq.total);
+
+                a.noalias() = w * x;
+                for(Index k = 0; k < a.cols(); ++k) a.col(k) += b.col(0);
+
+                const functor::sigmoid_op<S> sigmoid;
+                const functor::tanh_op<S> tanh;
+                for(Index t = 0; t < seq.steps(); ++t){
+                    const Index o = seq.offsets[t], n = seq.batch_sizes[t];
+                    if(t > 0) a.middleCols(o, n).noalias() += u * h.middleCols(seq.offsets[t - 1], n);
+
+                    for(Index k = o; k < o + n; ++k){
+                        auto g = a.col(k);
+                        g.segment(0, 2 * H) = g.segment(0, 2 * H).unaryExpr(sigmoid);
+                        g.segment(2 * H, H) = g.segment(2 * H, H).unaryExpr(tanh);
+                        g.segment(3 * H, H) = g.segment(3 * H, H).unaryExpr(sigmoid);
+
+                        auto ck = c.col(k).array();
+                        if(t > 0){
+                            const Index p = seq.offsets[t - 1] + (k - o);
+                            ck = g.segment(H, H).array() * c.col(p).array() + g.segment(0, H).array() * g.segment(2 * H, H).array();
+                        } else {
+                            ck = g.segment(0, H).array() * g.segment(2 * H, H).array();
+                        }
+                        h.col(k).array() = g.segment(3 * H, H).array() * ck.unaryExpr(tanh);
+                    }
+                }
+            }
+
+            static void backward(const MatrixType& x, const MatrixType& w, const MatrixType& u, const MatrixType& h,
+                    const MatrixType& dout, RecurrentState<S>& st,
+                    MatrixType* dx, MatrixType* dw, MatrixType* du, MatrixType* db){
+                const auto& seq = st.seq;
+                const Index H = u.cols(), first = seq.batch_sizes.empty() ? 0 : seq.batch_sizes[0];
+                const auto& a = st.gates;
+                const auto& c = st.aux;
+                auto& dg = st.dgates;
+                dg.resize(4 * H, seq.total);
+                st.carry.setZero(H, first);
+                st.carry_cell.setZero(H, first);
+
+                const functor::tanh_op<S> tanh;
+                for(Index t = seq.steps() - 1; t >= 0; --t){
+                    const Index o = seq.offsets[t], n = seq.batch_sizes[t];
+                    for(Index k = 0; k < n; ++k){
+                        const auto g = a.col(o + k).array();
+                        const auto i = g.segment(0, H), f = g.segment(H, H), gg = g.segment(2 * H, H), og = g.segment(3 * H, H);
+                        const auto tc = c.col(o + k).array().unaryExpr(tanh).eval();
+                        const auto dh = (dout.col(o + k).array() + st.carry.col(k).array()).eval();
+                        auto d = dg.col(o + k).array();
+
+                        auto dc = st.carry_cell.col(k).array();
+                        dc += dh * og * (S(1) - tc * tc);
+                        d.segment(3 * H, H) = dh * tc * og * (S(1) - og);
+                        d.segment(0, H) = dc * gg * i * (S(1) - i);
+                        d.segment(2 * H, H) = dc * i * (S(1) - gg * gg);
+                        if(t > 0){
+                            d.segment(H, H) = dc * c.col(seq.offsets[t - 1] + k).array() * f * (S(1) - f);
+                        } else {
+                            d.segment(H, H).setZero();
+                        }
+                        dc *= f;
+                    }
+                    if(t > 0) st.carry.leftCols(n).noalias() = u.transpose() * dg.middleCols(o, n);
+                }
+
+                recurrent_weight_deltas(x, w, h, dg, dg, st, dx, dw, du, db);
+            }
+        };
+
+        // gates r, z, n : n = tanh(W_n x + b_n + r * U_n h), h' = (1 - z) * n + z * h
+        template<typename S>
+        struct Gru {
+            using MatrixType = Matrix<S>;
+
+            static void forward(const MatrixType& x, const MatrixType& w, const MatrixType& u, const MatrixType& b,
+                    RecurrentState<S>& st, MatrixType& h){
+                const auto& seq = st.seq;
+                const Index H = u.cols(), first = seq.batch_sizes.empty() ? 0 : seq.batch_sizes[0];
+                auto& a = st.gates;
+                auto& un = st.aux;
+                un.resize(H, seq.total);
+
+                a.noalias() = w * x;
+                for(Index k = 0; k < a.cols(); ++k) a.col(k) += b.col(0);
+
+                // U * h of one step
+                MatrixType uh(3 * H, first);
+
+                const functor::sigmoid_op<S> sigmoid;
+                const functor::tanh_op<S> tanh;
+                for(Index t = 0; t < seq.steps(); ++t){
+                    const Index o = seq.offsets[t], n = seq.batch_sizes[t];
+                    if(t > 0){
+                        uh.leftCols(n).noalias() = u * h.middleCols(seq.offsets[t - 1], n);
+                    } else {
+                        uh.setZero();
+                    }
+
+                    for(Index k = 0; k < n; ++k){
+                        auto g = a.col(o + k);
+                        g.segment(0, 2 * H) = (g.segment(0, 2 * H) + uh.col(k).segment(0, 2 * H)).unaryExpr(sigmoid);
+                        un.col(o + k) = uh.col(k).segment(2 * H, H);
+                        g.segment(2 * H, H) = (g.segment(2 * H, H).array()
+                                + g.segment(0, H).array() * un.col(o + k).array()).unaryExpr(tanh).matrix();
+
+                        const auto z = g.segment(H, H).array(), nn = g.segment(2 * H, H).array();
+                        if(t > 0){
+                            h.col(o + k).array() = nn + z * (h.col(seq.offsets[t - 1] + k).array() - nn);
+                        } else {
+                            h.col(o + k).array() = (S(1) - z) * nn;
+                        }
+                    }
+                }
+            }
+
+            static void backward(const MatrixType& x, const MatrixType& w, const MatrixType& u, const MatrixType& h,
+                    const MatrixType& dout, RecurrentState<S>& st,
+                    MatrixType* dx, MatrixType* dw, MatrixType* du, MatrixType* db){
+                const auto& seq = st.seq;
+                const Index H = u.cols(), first = seq.batch_sizes.empty() ? 0 : seq.batch_sizes[0];
+                const auto& a = st.gates;
+                const auto& un = st.aux;
+                auto& dg = st.dgates;
+                auto& duh = st.dhidden;
+                dg.resize(3 * H, seq.total);
+                duh.resize(3 * H, seq.total);
+                st.carry.setZero(H, first);
+
+                for(Index t = seq.steps() - 1; t >= 0; --t){
+                    const Index o = seq.offsets[t], n = seq.batch_sizes[t];
+                    for(Index k = 0; k < n; ++k){
+                        const auto g = a.col(o + k).array();
+                        const auto r = g.segment(0, H), z = g.segment(H, H), nn = g.segment(2 * H, H);
+                        const auto dh = (dout.col(o + k).array() + st.carry.col(k).array()).eval();
+                        auto d = dg.col(o + k).array();
+                        auto dr = duh.col(o + k).array();
+
+                        // n
+                        d.segment(2 * H, H) = dh * (S(1) - z) * (S(1) - nn * nn);
+                        dr.segment(2 * H, H) = d.segment(2 * H, H) * r;
+                        // r
+                        d.segment(0, H) = d.segment(2 * H, H) * un.col(o + k).array() * r * (S(1) - r);
+                        // z (and h of the previous step, directly)
+                        if(t > 0){
+                            const auto hp = h.col(seq.offsets[t - 1] + k).array();
+                            d.segment(H, H) = dh * (hp - nn) * z * (S(1) - z);
+                            st.carry.col(k).array() = dh * z;
+                        } else {
+                            d.segment(H, H) = -dh * nn * z * (S(1) - z);
+                        }
+                        dr.segment(0, 2 * H) = d.segment(0, 2 * H);
+                    }
+                    if(t > 0) st.carry.leftCols(n).noalias() += u.transpose() * duh.middleCols(o, n);
+                }
+
+                recurrent_weight_deltas(x, w, h, dg, duh, st, dx, dw, du, db);
+            }
+        };
+
+        template<typename Cell, typename T1, typename T2, typename T3, typename T4, typename T5>
+        decltype(auto) recurrent_operator(const T1 &t, const T2 &w, const T3 &u, const T4 &b, const T5 &lengths,
+                Index gates, const char* shape_error){
+            LAZY_TYPEDEF_OPERATOR(T1);
+            using K = Kernel<ValueType, 5>;
+            const auto state = std::make_shared<RecurrentState<ScalarType>>();
+
+            K kernel;
+            kernel.shape = [state, gates, shape_error](const typename K::Inputs& in) -> typename K::Shape {
+                const auto& x = *in[0];
+                const auto& w = *in[1];
+                const auto& u = *in[2];
+                const auto& b = *in[3];
+                const Index H = u.cols();
+                state->seq = PackedSequence::fromLengths(*in[4]);
+                if(w.rows() != gates * H || w.cols() != x.rows() || u.rows() != gates * H
+                        || b.rows() != gates * H || b.cols() != 1 || x.cols() != state->seq.total)
+                    throw std::runtime_error(shape_error);
+                return {H, x.cols()};
+            };
+            kernel.forward = [state](const typename K::Inputs& in, ValueType& out){
+                Cell::forward(*in[0], *in[1], *in[2], *in[3], *state, out);
+            };
+            kernel.backward = [state](const typename K::Inputs& in, const ValueType* out, const ValueType& dout,
+                    const typename K::Deltas& din){
+                Cell::backward(*in[0], *in[1], *in[2], *out, dout, *state, din[0], din[1], din[2], din[3]);
+            };
+            kernel.backward_reads_output = true;
+
+            return make_kernel_operand<ValueType, 5>(std::make_shared<const K>(std::move(kernel)),
+                    {PtrType(t), PtrType(w), PtrType(u), PtrType(b), PtrType(lengths)});
+        }
+    }
+
+    /*
+     * Recurrent layers over packed sequences, as one operator whatever the number of steps
+     * x : inputs x total (packed), lengths : 1 x batch -> hidden states, hidden x total (packed)
+     * lstm : W 4H x inputs, U 4H x H, b 4H x 1 (gates i, f, g, o)
+     * gru  : W 3H x inputs, U 3H x H, b 3H x 1 (gates r, z, n)
+     * The initial state is zero. d(ret) / d(lengths) is undefined.
+     */
+
+    template<typename T1, typename T2, typename T3, typename T4, typename T5>
+    [[nodiscard]] decltype(auto) lstm
+            (const T1 &t, const T2 &w, const T3 &u, const T4 &b, const T5 &lengths){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        return detail::recurrent_operator<detail::Lstm<ScalarType>>(t, w, u, b, lengths, 4, "lazy: lstm shapes do not match");
+    }
+
+    template<typename T1, typename T2, typename T3, typename T4, typename T5>
+    [[nodiscard]] decltype(auto) gru
+            (const T1 &t, const T2 &w, const T3 &u, const T4 &b, const T5 &lengths){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        return detail::recurrent_operator<detail::Gru<ScalarType>>(t, w, u, b, lengths, 3, "lazy: gru shapes do not match");
+    }
+
+    /*
+     * last_step : the state of every sequence at its last step, hidden x batch
+     */
+
+    template<typename T1, typename T2>
+    [[nodiscard]] decltype(auto) last_step
+            (const T1 &t, const T2 &lengths){
+        LAZY_TYPEDEF_OPERATOR(T1);
+        using K = Kernel<ValueType, 2>;
+
+        // column of the last step of every sequence, and the number of columns
+        struct State {
+            std::vector<Index> columns;
+            Index total = 0;
+        };
+        const auto state = std::make_shared<State>();
+
+        K kernel;
+        kernel.shape = [state](const typename K::Inputs& in) -> typename K::Shape {
+            const auto seq = PackedSequence::fromLengths(*in[1]);
+            if(in[0]->cols() != seq.total)
+                throw std::runtime_error("lazy: last_step shapes do not match");
+            state->total = seq.total;
+            state->columns.resize(static_cast<std::size_t>(seq.batch()));
+            for(Index i = 0; i < seq.batch(); ++i)
+                state->columns[i] = seq.offsets[seq.lengths[i] - 1] + i;
+            return {in[0]->rows(), seq.batch()};
+        };
+        kernel.forward = [state](const typename K::Inputs& in, ValueType& out){
+            for(Index i = 0; i < out.cols(); ++i) out.col(i) = in[0]->col(state->columns[i]);
+        };
+        kernel.backward = [state](const typename K::Inputs&, const ValueType*, const ValueType& dout,
+                const typename K::Deltas& din){
+            if(!din[0]) return;
+            din[0]->setZero(dout.rows(), state->total);
+            for(Index i = 0; i < dout.cols(); ++i) din[0]->col(state->columns[i]) = dout.col(i);
+        };
+        kernel.backward_reads_inputs = false;
+
+        return make_kernel_operand<ValueType, 2>(std::make_shared<const K>(std::move(kernel)),
+                {PtrType(t), PtrType(lengths)});
+    }
+}
+
+#endif //LAZYDEEP1_RECURRENT_HPP
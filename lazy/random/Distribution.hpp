@@ -0,0 +1,170 @@
+#ifndef LAZYDEEP1_DISTRIBUTION_HPP
+#define LAZYDEEP1_DISTRIBUTION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include "../Operand.hpp"
+#include "Philox.hpp"
+
+namespace lazy::random {
+
+    /*
+     * Filling dense matrices from a Philox stream
+     *
+     * Element i (in storage order) always takes its words from the same counter blocks,
+     * so the result depends only on (seed, stream, offset) and not on the number of threads.
+     * Every fill advances the generator past the blocks it used.
+     */
+
+    namespace detail {
+        // words taken by one element: 1 for float, 2 for double
+        template<typename S>
+        constexpr std::size_t words_of = sizeof(S) <= 4 ? 1 : 2;
+
+        // words of one chunk, the unit of parallel work
+        constexpr std::size_t chunk_words = 4 * Philox::Lanes;
+
+        // per_chunk<S> elements in a chunk; element i takes word i (and word i + per_chunk<S> for double)
+        template<typename S>
+        constexpr std::size_t per_chunk = chunk_words / words_of<S>;
+
+        template<typename S>
+        inline S to_unit(const std::uint32_t* words, Index i){
+            if constexpr(words_of<S> == 1){
+                return S(words[i] >> 8) * S(1.0 / 16777216.0);
+            } else {
+                const std::uint64_t bits = (static_cast<std::uint64_t>(words[i] >> 5) << 26)
+                        | (words[i + per_chunk<S>] >> 6);
+                return S(bits) * S(1.0 / 9007199254740992.0);
+            }
+        }
+
+        // inverse error function for |x| < 0.99 (single precision, Giles 2010); branch-free
+        template<typename S>
+        inline S erfinv_central(S x){
+            S w = -std::log((S(1) - x) * (S(1) + x)) - S(2.5);
+            S p = S(2.81022636e-08);
+            p = S(3.43273939e-07) + p * w;
+            p = S(-3.5233877e-06) + p * w;
+            p = S(-4.39150654e-06) + p * w;
+            p = S(0.00021858087) + p * w;
+            p = S(-0.00125372503) + p * w;
+            p = S(-0.00417768164) + p * w;
+            p = S(0.246640727) + p * w;
+            p = S(1.50140941) + p * w;
+            return p * x;
+        }
+
+        /*
+         * f(first, words, count) converts count (<= per_chunk<S>) elements starting at element first
+         * from the chunk_words words of their chunk. Chunks run in parallel.
+         */
+        template<typename S, typename F>
+        void generate(Philox& gen, Index size, F&& f){
+            const Index chunks = (size + per_chunk<S> - 1) / per_chunk<S>;
+
+            #pragma omp parallel for schedule(static) if(chunks > 64)
+            for(Index c = 0; c < chunks; ++c){
+                std::uint32_t words[4][Philox::Lanes];
+                gen.generate(static_cast<std::uint64_t>(c) * Philox::Lanes, words);
+
+                const Index first = c * per_chunk<S>;
+                f(first, &words[0][0], std::min<Index>(per_chunk<S>, size - first));
+            }
+
+            gen.discard(static_cast<std::uint64_t>(chunks) * Philox::Lanes);
+        }
+    }
+
+    // uniform in [low, high)
+    template<typename T>
+    void fill_uniform(T& m, typename T::Scalar low, typename T::Scalar high, Philox& gen){
+        using S = typename T::Scalar;
+        S* data = m.data();
+        const S scale = high - low;
+
+        detail::generate<S>(gen, m.size(), [=](Index first, const std::uint32_t* words, Index count){
+            for(Index i = 0; i < count; ++i)
+                data[first + i] = low + scale * detail::to_unit<S>(words, i);
+        });
+    }
+
+    // normal(mean, stddev) by the Box-Muller transform
+    template<typename T>
+    void fill_normal(T& m, typename T::Scalar mean, typename T::Scalar stddev, Philox& gen){
+        using S = typename T::Scalar;
+        constexpr S two_pi = S(6.283185307179586);
+        constexpr S half_pi = S(1.5707963267948966);
+        S* data = m.data();
+
+        detail::generate<S>(gen, m.size(), [=](Index first, const std::uint32_t* words, Index count){
+            // pairs (i, i + half) of the chunk
+            constexpr Index half = detail::per_chunk<S> / 2;
+            S z[detail::per_chunk<S>];
+            for(Index i = 0; i < half; ++i){
+                const S u1 = S(1) - detail::to_unit<S>(words, i);
+                const S u2 = detail::to_unit<S>(words, i + half);
+                const S r = stddev * std::sqrt(S(-2) * std::log(u1));
+                // sin(a) as cos(a - pi/2), so that the pair is not fused into sincos, which does not vectorize
+                z[i] = mean + r * std::cos(two_pi * u2);
+                z[i + half] = mean + r * std::cos(two_pi * u2 - half_pi);
+            }
+            std::copy(z, z + count, data + first);
+        });
+    }
+
+    // normal(mean, stddev) restricted to mean +- bound * stddev, by inverting the CDF (no rejection)
+    // the inverse is accurate for bound <= 2.5
+    template<typename T>
+    void fill_truncated_normal(T& m, typename T::Scalar mean, typename T::Scalar stddev, Philox& gen,
+            typename T::Scalar bound = 2){
+        using S = typename T::Scalar;
+        S* data = m.data();
+        // u in [0, 1) -> erf^-1 of [-erf(b/sqrt2), erf(b/sqrt2))
+        const S e = std::erf(bound / std::sqrt(S(2)));
+        const S scale = stddev * std::sqrt(S(2));
+
+        detail::generate<S>(gen, m.size(), [=](Index first, const std::uint32_t* words, Index count){
+            for(Index i = 0; i < count; ++i){
+                const S x = e * (S(2) * detail::to_unit<S>(words, i) - S(1));
+                data[first + i] = mean + scale * detail::erfinv_central(x);
+            }
+        });
+    }
+
+    namespace detail {
+        // p * 2^32, compared against raw words
+        inline std::uint64_t bernoulli_threshold(double p){
+            return p >= 1 ? 0x100000000ull : p <= 0 ? 0 : static_cast<std::uint64_t>(p * 4294967296.0);
+        }
+    }
+
+    // 1 with probability p, 0 otherwise
+    template<typename T>
+    void fill_bernoulli(T& m, double p, Philox& gen){
+        using S = typename T::Scalar;
+        S* data = m.data();
+        const std::uint64_t threshold = detail::bernoulli_threshold(p);
+
+        detail::generate<float>(gen, m.size(), [=](Index first, const std::uint32_t* words, Index count){
+            for(Index i = 0; i < count; ++i)
+                data[first + i] = static_cast<std::uint64_t>(words[i]) < threshold ? S(1) : S(0);
+        });
+    }
+
+    // the same draws as fill_bernoulli, packed : bit (i % 64) of bits[i / 64] for element i
+    inline void fill_bernoulli_bits(std::uint64_t* bits, Index size, double p, Philox& gen){
+        static_assert(detail::per_chunk<float> == 64, "lazy: a chunk must fill one word of bits");
+        const std::uint64_t threshold = detail::bernoulli_threshold(p);
+
+        detail::generate<float>(gen, size, [=](Index first, const std::uint32_t* words, Index count){
+            std::uint64_t word = 0;
+            for(Index i = 0; i < count; ++i)
+                word |= std::uint64_t(static_cast<std::uint64_t>(words[i]) < threshold) << i;
+            bits[first / 64] = word;
+        });
+    }
+}
+
+#endif //LAZYDEEP1_DISTRIBUTION_HPP
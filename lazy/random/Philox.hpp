@@ -0,0 +1,167 @@
+#ifndef LAZYDEEP1_PHILOX_HPP
+#define LAZYDEEP1_PHILOX_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <random>
+
+namespace lazy::random {
+
+    /*
+     * Philox4x32-10 counter-based generator (Salmon et al., SC'11)
+     *
+     * Block b of stream s under key k is philox(k, {b, s}) : 4 words.
+     * Any block can be computed independently, so a matrix can be filled
+     * in parallel chunks and still get the same numbers for the same seed,
+     * whatever the number of threads.
+     */
+
+    class Philox {
+    public:
+        using result_type = std::uint32_t;
+
+        // number of blocks computed together (lanes of the SIMD loop)
+        static constexpr std::size_t Lanes = 16;
+
+        explicit Philox(std::uint64_t seed = 0, std::uint64_t stream = 0) noexcept
+        : m_key(seed), m_stream(stream), m_offset(0), m_buffer(), m_used(4) {
+
+        }
+
+        /*
+         * Counter-based interface
+         */
+
+        // writes blocks [first, first + count) of this stream (4 words each, relative to offset())
+        void generate(std::uint64_t first, std::size_t count, std::uint32_t* out) const noexcept {
+            std::uint32_t lanes[4][Lanes];
+            for(std::size_t done = 0; done < count; done += Lanes){
+                const std::size_t n = count - done < Lanes ? count - done : Lanes;
+                batch(m_offset + first + done, lanes);
+                for(std::size_t i = 0; i < n; ++i){
+                    for(std::size_t w = 0; w < 4; ++w) out[4 * (done + i) + w] = lanes[w][i];
+                }
+            }
+        }
+
+        // 4 * Lanes words of blocks [first, first + Lanes), lane-major (words[w][lane])
+        void generate(std::uint64_t first, std::uint32_t (&words)[4][Lanes]) const noexcept {
+            batch(m_offset + first, words);
+        }
+
+        std::uint64_t offset() const noexcept {
+            return m_offset;
+        }
+
+        void discard(std::uint64_t blocks) noexcept {
+            m_offset += blocks;
+            m_used = 4;
+        }
+
+        std::uint64_t key() const noexcept {
+            return m_key;
+        }
+
+        std::uint64_t stream() const noexcept {
+            return m_stream;
+        }
+
+        // same key, independent stream
+        Philox fork(std::uint64_t stream) const noexcept {
+            return Philox(m_key, stream);
+        }
+
+        /*
+         * UniformRandomBitGenerator interface (for std distributions)
+         */
+
+        static constexpr result_type min() noexcept { return 0; }
+        static constexpr result_type max() noexcept { return 0xFFFFFFFFu; }
+
+        result_type operator()() noexcept {
+            if(m_used == 4){
+                generate(0, 1, m_buffer);
+                ++m_offset;
+                m_used = 0;
+            }
+            return m_buffer[m_used++];
+        }
+
+    private:
+        std::uint64_t m_key;
+        std::uint64_t m_stream;
+        std::uint64_t m_offset;
+
+        std::uint32_t m_buffer[4];
+        unsigned m_used;
+
+        // 10 rounds over Lanes consecutive counters; the lane loop is written to be vectorized
+        void batch(std::uint64_t first, std::uint32_t (&out)[4][Lanes]) const noexcept {
+            constexpr std::uint64_t M0 = 0xD2511F53u, M1 = 0xCD9E8D57u;
+            constexpr std::uint32_t W0 = 0x9E3779B9u, W1 = 0xBB67AE85u;
+
+            const std::uint32_t s0 = static_cast<std::uint32_t>(m_stream);
+            const std::uint32_t s1 = static_cast<std::uint32_t>(m_stream >> 32);
+            const std::uint32_t key0 = static_cast<std::uint32_t>(m_key);
+            const std::uint32_t key1 = static_cast<std::uint32_t>(m_key >> 32);
+
+            for(std::size_t i = 0; i < Lanes; ++i){
+                const std::uint64_t ctr = first + i;
+                std::uint32_t c0 = static_cast<std::uint32_t>(ctr);
+                std::uint32_t c1 = static_cast<std::uint32_t>(ctr >> 32);
+                std::uint32_t c2 = s0, c3 = s1;
+                std::uint32_t k0 = key0, k1 = key1;
+
+                for(int round = 0; round < 10; ++round){
+                    const std::uint64_t p0 = M0 * c0;
+                    const std::uint64_t p1 = M1 * c2;
+                    c0 = static_cast<std::uint32_t>(p1 >> 32) ^ c1 ^ k0;
+                    c2 = static_cast<std::uint32_t>(p0 >> 32) ^ c3 ^ k1;
+                    c1 = static_cast<std::uint32_t>(p1);
+                    c3 = static_cast<std::uint32_t>(p0);
+                    k0 += W0;
+                    k1 += W1;
+                }
+
+                out[0][i] = c0;
+                out[1][i] = c1;
+                out[2][i] = c2;
+                out[3][i] = c3;
+            }
+        }
+    };
+
+    /*
+     * Global seed
+     * Every generator made by make_generator() gets its own stream of the global seed,
+     * so a whole program is reproducible from set_seed() when the graph is built in the same order.
+     * Without set_seed(), the seed comes from std::random_device.
+     */
+
+    struct GlobalSeed {
+        std::uint64_t seed;
+        std::atomic<std::uint64_t> stream;
+    };
+
+    inline GlobalSeed& global_seed(){
+        static GlobalSeed global{[](){
+            std::random_device rd;
+            return (static_cast<std::uint64_t>(rd()) << 32) | rd();
+        }(), {0}};
+        return global;
+    }
+
+    inline void set_seed(std::uint64_t seed){
+        auto& global = global_seed();
+        global.seed = seed;
+        global.stream = 0;
+    }
+
+    inline Philox make_generator(){
+        auto& global = global_seed();
+        return Philox(global.seed, global.stream++);
+    }
+}
+
+#endif //LAZYDEEP1_PHILOX_HPP
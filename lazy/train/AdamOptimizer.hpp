@@ -5,6 +5,7 @@
 #ifndef LAZYDEEP1_ADAMOPTIMIZER_HPP
 #define LAZYDEEP1_ADAMOPTIMIZER_HPP
 
+#include <cmath>
 #include "Optimizer.hpp"
 
 namespace lazy::train {
@@ -27,12 +28,18 @@ namespace lazy::train {
 
         OptFunction minimize(const OperandPtrType& target, const VariableSet& var_list) override{
             return [this, target, var_list](PlaceholderMap mp) -> T{
-                PlaceholderMap ph = std::move(mp);
-                VariableMap grad = this->computeGradients(target, ph, var_list);
+                // the batch is moved into the placeholders; an empty map keeps what was fed/bound
+                Placeholder<T>::applyPlaceholders(std::move(mp));
+                VariableSet dense = var_list;
+                ColumnMap sparse = this->computeColumnGradients(target, dense);
+                VariableMap grad = this->computeGradients(target, {}, dense);
                 T ret = target->eval();
 
+                // (before the dense moments, which advance m_b1 / m_b2)
+                this->adjustColumnMomentum(sparse);
                 this->adjustMomentumAndGradients(grad);
                 this->applyGradients(grad);
+                this->applyColumnGradients(sparse);
 
                 return ret;
             };
@@ -46,11 +53,20 @@ namespace lazy::train {
         VariableMap m_first;
         VariableMap m_second;
 
+        // moments of variables with column gradients (slots of the variable, see Variable::makeSlot),
+        // and the step each column was last updated at
+        struct ColumnMoments {
+            VariablePtrType first, second;
+            std::vector<Index> last;
+        };
+        std::map<VariablePtrType, ColumnMoments> m_columns;
+        Index m_step = 0;
+
         void adjustMomentumAndGradients(VariableMap& grad){
             if(m_first.empty() || m_second.empty()){
                 for(auto& [ptr, value]: grad){
-                    m_first.emplace(std::make_pair(ptr, T::Zero(value.rows(), value.cols())));
-                    m_second.emplace(std::make_pair(ptr, T::Zero(value.rows(), value.cols())));
+                    m_first.emplace(std::make_pair(ptr, value_traits<T>::zeros_like(value)));
+                    m_second.emplace(std::make_pair(ptr, value_traits<T>::zeros_like(value)));
                 }
             }
 
@@ -67,6 +83,44 @@ namespace lazy::train {
             m_b1 *= m_beta1;
             m_b2 *= m_beta2;
         }
+
+        // lazy Adam : the moments of a column decay for all the steps since its last update
+        // when it is touched again, as they would have with zero gradients; columns that are not
+        // touched are not moved
+        void adjustColumnMomentum(ColumnMap& grad){
+            ++m_step;
+            if constexpr (value_traits<T>::column_deltas) {
+                for(auto& [ptr, d]: grad){
+                    auto it = m_columns.find(ptr);
+                    if(it == m_columns.end()){
+                        it = m_columns.emplace(ptr, ColumnMoments{ptr->makeSlot(), ptr->makeSlot(), {}}).first;
+                    }
+                    auto& [first, second, last] = it->second;
+                    if(d.columns.empty()) continue;
+
+                    // decay of every column over the steps it missed
+                    if(last.size() <= static_cast<std::size_t>(d.columns.back())) last.resize(d.columns.back() + 1, 0);
+                    std::vector<Scalar> steps(d.columns.size());
+                    for(std::size_t k = 0; k < d.columns.size(); ++k){
+                        steps[k] = static_cast<Scalar>(m_step - last[d.columns[k]]);
+                        last[d.columns[k]] = m_step;
+                    }
+
+                    T& g = d.values;
+                    T m(g.rows(), g.cols());
+                    first->updateColumns(d.columns, [&](std::size_t k, auto column){
+                        const auto i = static_cast<Index>(k);
+                        column = column * std::pow(m_beta1, steps[k]) + g.col(i) * (1 - m_beta1);
+                        m.col(i) = column / (1 - m_b1);
+                    });
+                    second->updateColumns(d.columns, [&](std::size_t k, auto column){
+                        const auto i = static_cast<Index>(k);
+                        column = column * std::pow(m_beta2, steps[k]) + g.col(i).cwiseAbs2() * (1 - m_beta2);
+                        g.col(i) = m.col(i).cwiseQuotient(((column / (1 - m_b2)).cwiseSqrt().array() + m_eps).matrix());
+                    });
+                }
+            }
+        }
     };
 }
 
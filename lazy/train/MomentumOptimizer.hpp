@@ -5,6 +5,7 @@
 #ifndef LAZYDEEP1_MOMENTUMOPTIMIZER_HPP
 #define LAZYDEEP1_MOMENTUMOPTIMIZER_HPP
 
+#include <cmath>
 #include "Optimizer.hpp"
 
 namespace lazy::train {
@@ -25,16 +26,21 @@ namespace lazy::train {
 
         OptFunction minimize(const OperandPtrType& target, const VariableSet& var_list) override{
             return [this, target, var_list](PlaceholderMap mp) -> T{
-                PlaceholderMap ph = std::move(mp);
-                VariableMap grad = this->computeGradients(target, ph, var_list);
+                // the batch is moved into the placeholders; an empty map keeps what was fed/bound
+                Placeholder<T>::applyPlaceholders(std::move(mp));
+                VariableSet dense = var_list;
+                ColumnMap sparse = this->computeColumnGradients(target, dense);
+                VariableMap grad = this->computeGradients(target, {}, dense);
                 T ret = target->eval();
 
+                this->adjustColumnMomentum(sparse);
                 if(m_nag) {
                     this->applyMomentum(grad);
-                    grad = this->computeGradients(target, ph, var_list);
+                    grad = this->computeGradients(target, {}, dense);
                 }
                 this->adjustMomentumWith(grad);
                 this->applyGradients(grad);
+                this->applyColumnGradients(sparse);
 
                 return ret;
             };
@@ -46,9 +52,18 @@ namespace lazy::train {
 
         VariableMap m_accumulation;
 
+        // accumulations of variables with column gradients (slots of the variable, see Variable::makeSlot),
+        // and the step each column was last updated at
+        struct ColumnAccumulation {
+            VariablePtrType value;
+            std::vector<Index> last;
+        };
+        std::map<VariablePtrType, ColumnAccumulation> m_columns;
+        Index m_step = 0;
+
         void initMomentum(VariableMap& grad){
             for(auto& [ptr, value]: grad){
-                m_accumulation.emplace(std::make_pair(ptr, T::Zero(value.rows(), value.cols())));
+                m_accumulation.emplace(std::make_pair(ptr, value_traits<T>::zeros_like(value)));
             }
         }
 
@@ -62,6 +77,35 @@ namespace lazy::train {
             }
         }
 
+        // lazy momentum : the accumulation of a column decays for all the steps since its last
+        // update when it is touched again; columns that are not touched are not moved.
+        // Nesterov uses g + momentum * accumulation, which needs no second gradient.
+        void adjustColumnMomentum(ColumnMap& grad){
+            ++m_step;
+            if constexpr (value_traits<T>::column_deltas) {
+                for(auto& [ptr, d]: grad){
+                    auto it = m_columns.find(ptr);
+                    if(it == m_columns.end()){
+                        it = m_columns.emplace(ptr, ColumnAccumulation{ptr->makeSlot(), {}}).first;
+                    }
+                    auto& [acc, last] = it->second;
+                    if(d.columns.empty()) continue;
+
+                    if(last.size() <= static_cast<std::size_t>(d.columns.back())) last.resize(d.columns.back() + 1, 0);
+                    T& g = d.values;
+                    acc->updateColumns(d.columns, [&](std::size_t k, auto column){
+                        const auto i = static_cast<Index>(k);
+                        const Index c = d.columns[k];
+                        column = column * std::pow(m_momentum, static_cast<Scalar>(m_step - last[c])) + g.col(i);
+                        last[c] = m_step;
+
+                        if(m_nag) g.col(i) += column * m_momentum;
+                        else g.col(i) = column;
+                    });
+                }
+            }
+        }
+
         void applyMomentum(VariableMap& grad){
             if(m_accumulation.empty()){
                 initMomentum(grad);
@@ -7,6 +7,9 @@
 
 #include <set>
 #include <map>
+#include <vector>
+#include <numeric>
+#include <algorithm>
 #include "../Variable.hpp"
 #include "../Placeholder.hpp"
 
@@ -17,9 +20,39 @@ using OperandPtrType = typename Operand<T>::Pointer; \
 using VariableSet = std::set<VariablePtrType>; \
 using VariableMap = std::map<VariablePtrType, T>; \
 using PlaceholderMap = std::map<PlaceholderPtrType, T>; \
+using ColumnMap = std::map<VariablePtrType, ColumnDelta<T>>; \
 using OptFunction = std::function<T(PlaceholderMap)>;
 
 namespace lazy::train {
+
+    namespace detail {
+        // sorts the columns of a column delta and sums the deltas of repeated ones
+        template<typename T>
+        void coalesce_columns(ColumnDelta<T>& d){
+            if(std::is_sorted(d.columns.begin(), d.columns.end(), std::less_equal<>())) return;
+
+            std::vector<std::size_t> order(d.columns.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&d](std::size_t a, std::size_t b){
+                return d.columns[a] < d.columns[b];
+            });
+
+            ColumnDelta<T> ret;
+            ret.values.resize(d.values.rows(), static_cast<Index>(order.size()));
+            for(std::size_t k: order){
+                const auto n = static_cast<Index>(ret.columns.size());
+                if(n > 0 && ret.columns.back() == d.columns[k]){
+                    ret.values.col(n - 1) += d.values.col(static_cast<Index>(k));
+                } else {
+                    ret.columns.push_back(d.columns[k]);
+                    ret.values.col(n) = d.values.col(static_cast<Index>(k));
+                }
+            }
+            ret.values.conservativeResize(Eigen::NoChange, static_cast<Index>(ret.columns.size()));
+            d = std::move(ret);
+        }
+    }
+
     template<typename T, typename Scalar = typename T::Scalar>
     class Optimizer {
     public:
@@ -35,11 +68,15 @@ namespace lazy::train {
 
         virtual OptFunction minimize(const OperandPtrType& target, const VariableSet& var_list){
             return [this, target, var_list](PlaceholderMap mp) -> T{
-                PlaceholderMap ph = std::move(mp);
-                VariableMap grad = computeGradients(target, ph, var_list);
+                // the batch is moved into the placeholders; an empty map keeps what was fed/bound
+                Placeholder<T>::applyPlaceholders(std::move(mp));
+                VariableSet dense = var_list;
+                ColumnMap sparse = computeColumnGradients(target, dense);
+                VariableMap grad = computeGradients(target, {}, dense);
                 T ret = target->eval();
 
                 applyGradients(grad);
+                applyColumnGradients(sparse);
 
                 return ret;
             };
@@ -60,6 +97,40 @@ namespace lazy::train {
             }
         }
 
+        /*
+         * Column gradients
+         * Variables read only through a few columns at a time (e.g. embedding tables) get their
+         * gradient as those columns (see Operand::diffColumns) and are moved out of var_list,
+         * so a step costs the touched columns rather than the whole table.
+         */
+
+        virtual ColumnMap computeColumnGradients(const OperandPtrType& target, VariableSet& var_list){
+            ColumnMap ret;
+            if constexpr (value_traits<T>::column_deltas) {
+                for(auto it = var_list.begin(); it != var_list.end();){
+                    ColumnDelta<T> d;
+                    if((*it)->diffColumns(target, d)){
+                        detail::coalesce_columns(d);
+                        ret.emplace(*it, std::move(d));
+                        it = var_list.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            return ret;
+        }
+        virtual void applyColumnGradients(ColumnMap& grad){
+            if constexpr (value_traits<T>::column_deltas) {
+                for(auto& [ptr, d]: grad){
+                    const T& step = d.values;
+                    ptr->updateColumns(d.columns, [this, &step](std::size_t k, auto column){
+                        column -= step.col(static_cast<Index>(k)) * m_lr;
+                    });
+                }
+            }
+        }
+
     protected:
         Scalar m_lr;
 
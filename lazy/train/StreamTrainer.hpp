@@ -0,0 +1,118 @@
+#ifndef LAZYDEEP1_STREAMTRAINER_HPP
+#define LAZYDEEP1_STREAMTRAINER_HPP
+
+#include <atomic>
+#include <thread>
+#include "Optimizer.hpp"
+#include "../data/SampleRing.hpp"
+
+namespace lazy::train {
+
+    struct StreamOptions {
+        Index batch_size = 100;     // samples in one update
+        Index stride = 0;           // new samples between updates (0 : batch_size)
+    };
+
+    /*
+     * StreamTrainer : online training from a SampleRing filled by a producer thread
+     *
+     * Every update takes the batch_size oldest samples of the ring into a preallocated batch,
+     * releases `stride` of them and runs one optimizer step on the batch.
+     * stride < batch_size slides a window over the stream (samples are seen more than once),
+     * stride > batch_size subsamples it.
+     * The input / label placeholders are bound to the batch buffers, so nothing is allocated
+     * per batch, and the trainer polls the ring instead of waiting on the producer.
+     *
+     *   std::thread producer([&]{ ... ring.push(x, t) ...; ring.close(); });
+     *   train::StreamTrainer<Mat, ByteMat> trainer(opt, loss, x, t, ring);
+     *   trainer.run([](Index updates, const Mat& cost){ ... });
+     */
+
+    template<typename T, typename Input = T, typename Label = T>
+    class StreamTrainer {
+    public:
+        using Ring = data::SampleRing<Input, Label>;
+        using OperandPtrType = typename Operand<T>::Pointer;
+        using UpdateCallback = std::function<void(Index, const T&)>;
+
+        template<typename Scalar>
+        StreamTrainer(Optimizer<T, Scalar>& opt, const OperandPtrType& loss,
+                std::shared_ptr<Placeholder<Input>> input, std::shared_ptr<Placeholder<Label>> label,
+                Ring& ring, const StreamOptions& options = StreamOptions())
+        : m_step(opt.minimize(loss)), m_input(std::move(input)), m_label(std::move(label)), m_ring(ring),
+        m_batch_size(options.batch_size), m_stride(options.stride > 0 ? options.stride : options.batch_size),
+        m_batch_input(ring.inputRows(), options.batch_size), m_batch_label(ring.labelRows(), options.batch_size) {
+            if(std::max(m_batch_size, m_stride) > ring.capacity())
+                throw std::runtime_error("lazy: the sample ring is smaller than one update");
+        }
+
+        // Anything about Copy/Move is inhibited
+        StreamTrainer(const StreamTrainer&) = delete;
+        StreamTrainer& operator=(const StreamTrainer&) = delete;
+
+        // one update if the ring holds enough samples
+        bool step(){
+            if(m_ring.size() < required())
+                return false;
+
+            m_ring.peek(m_batch_size, m_batch_input, m_batch_label);
+            m_ring.drop(m_stride);
+
+            m_input->bind(m_batch_input);
+            m_label->bind(m_batch_label);
+            m_loss = m_step({});
+            ++m_updates;
+            return true;
+        }
+
+        // updates until the ring is closed and drained (or stop() is called)
+        void run(const UpdateCallback& on_update = {}){
+            m_stop.store(false, std::memory_order_relaxed);
+            while(!m_stop.load(std::memory_order_relaxed)){
+                if(step()){
+                    if(on_update) on_update(m_updates, m_loss);
+                    continue;
+                }
+                // closed first: after it, size() can only shrink
+                if(m_ring.closed() && m_ring.size() < required())
+                    break;
+                std::this_thread::yield();
+            }
+        }
+
+        // makes run() return after the current update (callable from any thread)
+        void stop() noexcept {
+            m_stop.store(true, std::memory_order_relaxed);
+        }
+
+        Index updates() const noexcept {
+            return m_updates;
+        }
+
+        // loss of the last update
+        const T& loss() const noexcept {
+            return m_loss;
+        }
+
+    private:
+        std::function<T(std::map<std::shared_ptr<Placeholder<T>>, T>)> m_step;
+        std::shared_ptr<Placeholder<Input>> m_input;
+        std::shared_ptr<Placeholder<Label>> m_label;
+        Ring& m_ring;
+
+        Index m_batch_size;
+        Index m_stride;
+        Input m_batch_input;
+        Label m_batch_label;
+
+        T m_loss;
+        Index m_updates = 0;
+        std::atomic<bool> m_stop{false};
+
+        Index required() const noexcept {
+            return std::max(m_batch_size, m_stride);
+        }
+    };
+}
+
+#endif //LAZYDEEP1_STREAMTRAINER_HPP
@@ -2,10 +2,12 @@
 
 #include <iostream>
 #include <iomanip>
-#include <fstream>
+#include <optional>
 #include <chrono>
 
 #include "lazy/ops/NN.hpp"
+#include "lazy/ops/Conv.hpp"
+#include "lazy/ops/Dense.hpp"
 
 #include "lazy/Variable.hpp"
 #include "lazy/Placeholder.hpp"
@@ -13,12 +15,16 @@
 #include "lazy/train/AdamOptimizer.hpp"
 #include "lazy/train/MomentumOptimizer.hpp"
 
+#include "lazy/data/Augment.hpp"
+#include "lazy/data/DataLoader.hpp"
+#include "lazy/data/IdxFile.hpp"
+#include "lazy/data/RecordFile.hpp"
+
 using namespace lazy;
 using Mat = Matrix<float>;
-using Byte = unsigned char;
+using Byte = std::uint8_t;
+using ByteMat = Matrix<Byte>;
 
-constexpr Index TOTAL_SZ = 60'000;
-constexpr Index TEST_SZ = 10'000;
 constexpr Index PIXEL_SZ = 28 * 28;
 
 const char TRAIN_IMG_FILE[] = "../examples/MNIST/train-images.idx3-ubyte";
@@ -26,18 +32,18 @@ const char TRAIN_LAB_FILE[] = "../examples/MNIST/train-labels.idx1-ubyte";
 const char TEST_IMG_FILE[] = "../examples/MNIST/t10k-images.idx3-ubyte";
 const char TEST_LAB_FILE[] = "../examples/MNIST/t10k-labels.idx1-ubyte";
 
-Byte train_img[TOTAL_SZ][PIXEL_SZ];
-Byte train_lab[TOTAL_SZ];
-Byte test_img[TEST_SZ][PIXEL_SZ];
-Byte test_lab[TEST_SZ];
+struct Dataset {
+    data::IdxFile images;
+    data::IdxFile labels;
+};
 
-bool load_data();
+std::optional<Dataset> load_data(const char* img_file, const char* lab_file, const std::string& name);
 
-void build_input(Byte img[][PIXEL_SZ], Byte lab[], Mat& input, Mat& sol, Index batch, Index batch_sz);
+void build_input(const Dataset& set, const Index* samples, Index count, ByteMat& input, Mat& sol);
 
 int main() {
     /*
-     * 3-layer NN example (MNIST)
+     * Convolutional NN example (MNIST)
      */
 
     std::cout << std::fixed;
@@ -49,47 +55,68 @@ int main() {
     std::cout << Eigen::nbThreads() << " thread(s) ready\n";
 
     std::cout << "Loading files..";
-    if(!load_data()){
+    const auto train_set = load_data(TRAIN_IMG_FILE, TRAIN_LAB_FILE, "train");
+    const auto test_set = load_data(TEST_IMG_FILE, TEST_LAB_FILE, "test");
+    if(!train_set || !test_set){
         std::cout << "failed\n";
         return 0;
     }
 
+    // training batches are shuffled, test batches are read in order
+    train_set->images.advise(data::access::random);
+    test_set->images.advise(data::access::sequential);
+
+    const Index TOTAL_SZ = train_set->images.count();
+    const Index TEST_SZ = test_set->images.count();
+
     std::cout << "Finish\nInitializing model..";
 
     // hyper-parameters
     constexpr Index batch_sz = 100;
-    constexpr Index total_batch = TOTAL_SZ / batch_sz;
+    const Index total_batch = TOTAL_SZ / batch_sz;
     constexpr Index total_epoch = 15;
-    constexpr Index test_batch = TEST_SZ / batch_sz;
-    constexpr Index middle_layer = 256;
+    constexpr Index channels1 = 8;
+    constexpr Index channels2 = 16;
 
     /*
      * Construct NN Layers
-     * 784 -> 256 -> 256 -> 10
+     * 1x28x28 -conv 3x3-> 8x28x28 -pool-> 8x14x14 -conv 3x3-> 16x14x14 -pool-> 16x7x7 -> 10
      */
 
     // Placeholder : to insert input and label
-    auto x = make_placeholder<Mat>(); // input
+    auto x = make_placeholder<ByteMat>(); // input (raw pixels)
     auto t = make_placeholder<Mat>(); // solution label
     auto dropout_attr = make_placeholder<Mat>(); // for dropout
 
+    const nn::ImageShape image{1, 28, 28};
+    const nn::Conv2dOptions conv(3, 1, 1);
+    const nn::Pool2dOptions pool(2);
+
+    const auto conv1_shape = nn::conv2d_shape(image, conv, channels1);
+    const auto pool1_shape = nn::pool2d_shape(conv1_shape, pool);
+    const auto conv2_shape = nn::conv2d_shape(pool1_shape, conv, channels2);
+    const auto pool2_shape = nn::pool2d_shape(conv2_shape, pool);
+
     // Variables : to optimize (i.e. Weights in this example)
-    auto W1 = random_normal_matrix_variable<float>(middle_layer, PIXEL_SZ, 0.f, 0.01f);
-    auto W2 = random_normal_matrix_variable<float>(middle_layer, middle_layer, 0.f, 0.01f);
-    auto W3 = random_normal_matrix_variable<float>(10, middle_layer, 0.f, 0.01f);
+    // a row of a convolution weight is one filter (channels x 3 x 3)
+    auto W1 = he_normal_matrix_variable<float>(channels1, image.channels * 9);
+    auto W2 = he_normal_matrix_variable<float>(channels2, channels1 * 9);
+    auto W3 = xavier_normal_matrix_variable<float>(10, pool2_shape.size());
+    auto b3 = zero_matrix_variable<float>(10, 1);
 
-    // Operands for middle layer
+    // Convolution layers
     // ReLU Activation Function is used
-    auto wx1 = dot_product(W1, x);
-    auto z1 = nn::relu(wx1);
-    auto dz1 = nn::dropout(z1, dropout_attr);
+    // pixels are scaled to [0, 1] inside the convolution
+    auto c1 = nn::conv2d(x, W1, image, conv, 1.f / 255.f);
+    auto p1 = nn::max_pool2d(nn::relu(c1), conv1_shape, pool);
 
-    auto wx2 = dot_product(W2, dz1);
-    auto z2 = nn::relu(wx2);
-    auto dz2 = nn::dropout(z2, dropout_attr);
+    auto c2 = nn::conv2d(p1, W2, pool1_shape, conv);
+    auto p2 = nn::max_pool2d(nn::relu(c2), conv2_shape, pool);
+    auto dp2 = nn::dropout(p2, dropout_attr);
 
     // Operands for output layer
-    auto wx3 = dot_product(W3, dz2);
+    // W3 * dp2 + b3 as one fused operator
+    auto wx3 = nn::dense(dp2, W3, b3, nn::activation::identity);
     auto model = nn::softmax(wx3, nn::input_type::colwise);
 
     // cost function (or value) - smaller is better
@@ -107,26 +134,45 @@ int main() {
     train::AdamOptimizer<Mat> opt(0.001f);
     auto training = opt.minimize(loss);
 
-    Mat input(PIXEL_SZ, batch_sz);
+    // Data loaders : batches are built on background threads while training
+    data::DataLoader<ByteMat, Mat> train_loader(TOTAL_SZ, batch_sz, PIXEL_SZ, 10,
+            [&train_set](const Index* samples, Index count, ByteMat& input, Mat& sol){
+                build_input(*train_set, samples, count, input, sol);
+            });
+
+    // random shifts and small rotations of the training images, on the loader threads
+    data::Augmentation<ByteMat> augment(28, 28);
+    augment.shift(2).rotate(10);
+    train_loader.augment([&augment](ByteMat& input, Mat&, random::Philox& gen){
+        augment(input, gen);
+    });
+
+    data::LoaderOptions test_options;
+    test_options.shuffle = false;
+    data::DataLoader<ByteMat, Mat> test_loader(TEST_SZ, batch_sz, PIXEL_SZ, 10,
+            [&test_set](const Index* samples, Index count, ByteMat& input, Mat& sol){
+                build_input(*test_set, samples, count, input, sol);
+            }, test_options);
 
     std::cout << "Training Start\n";
     auto train_start = std::chrono::system_clock::now();
 
-    Placeholder<Mat>::applyPlaceholders({{dropout_attr, nn::dropout_attr_matrix<Mat>(0.5f, true)}});
+    dropout_attr->feed(nn::dropout_attr_matrix<Mat>(0.5f, true));
 
     for(unsigned epoch = 0; epoch < total_epoch ; ++epoch){
         std::cout << "Epoch " << std::setw(2) << (epoch+1) << " : ";
         Mat total_cost = Mat::Zero(1, 1);
 
+        train_loader.start_epoch();
         for(Index batch = 0; batch < total_batch ; ++batch){
-            Mat sol = Mat::Zero(10, batch_sz);
+            const auto data = train_loader.next();
 
-            // construct input and sol matrix
-            build_input(train_img, train_lab, input, sol, batch, batch_sz);
+            // the placeholders read the batch buffer in place
+            x->bind(data->input);
+            t->bind(data->label);
 
             // training
-            auto cost = training({{x, input},
-                                  {t, sol}});
+            auto cost = training({});
             total_cost = total_cost + cost;
         }
 
@@ -143,16 +189,14 @@ int main() {
      * Test NN
      */
     std::cout << "Test Start..\n";
-    Placeholder<Mat>::applyPlaceholders({{dropout_attr, nn::dropout_attr_matrix<Mat>(0.5f, false)}});
+    dropout_attr->feed(nn::dropout_attr_matrix<Mat>(0.5f, false));
 
     int total_correct = 0;
 
-    for(Index iter = 0; iter < test_batch; ++iter){
-        // construct input
-        Mat sol = Mat::Zero(10, batch_sz);
-        build_input(test_img, test_lab, input, sol, iter, batch_sz);
-        Placeholder<Mat>::applyPlaceholders({{x, input},
-                                             {t, sol}});
+    test_loader.start_epoch();
+    while(const auto data = test_loader.next()){
+        x->bind(data->input);
+        t->bind(data->label);
 
         // evaluate
         const auto& res = corr->eval();
@@ -168,47 +212,27 @@ int main() {
  * MNIST Loader
  */
 
-bool load_bytes(const std::string &file, char* arr, long dummy_sz, long read_sz, const std::string& name){
-    std::ifstream f(file, std::ios::binary);
-    if(!f.is_open()){
-        std::cout << "Failed to open " << name << '\n';
-        return false;
-    }
-
-    f.seekg(dummy_sz, std::ios::beg);
-
-    f.read(arr, read_sz);
-    if(auto r = f.gcount(); r != read_sz){
-        std::cout << "Failed to read data of " << name << " (read " << r << " bytes after dummies)\n";
-        return false;
+std::optional<Dataset> load_data(const char* img_file, const char* lab_file, const std::string& name){
+    try {
+        Dataset set{data::IdxFile(img_file), data::IdxFile(lab_file)};
+        if(set.images.sampleSize() != PIXEL_SZ || set.images.count() != set.labels.count()){
+            std::cout << "Wrong shape of " << name << " data\n";
+            return std::nullopt;
+        }
+        return set;
+    } catch(const std::exception& e) {
+        std::cout << e.what() << '\n';
+        return std::nullopt;
     }
-
-    return true;
 }
 
-bool load_images(const std::string &file, Byte img[][PIXEL_SZ], long num, const std::string &name) {
-    return load_bytes(file, reinterpret_cast<char*>(img), 16, num * PIXEL_SZ, name);
-}
-
-bool load_labels(const std::string &file, Byte *lab, long num, const std::string &name) {
-    return load_bytes(file, reinterpret_cast<char*>(lab), 8, num, name);
-}
+void build_input(const Dataset& set, const Index* samples, Index count, ByteMat& input, Mat& sol){
+    const auto pixels = set.images.view(0, set.images.count());
+    const auto labels = set.labels.view(0, set.labels.count());
 
-bool load_data() {
-    const bool openTrain = load_images(TRAIN_IMG_FILE, train_img, TOTAL_SZ, "train images") &&
-                           load_labels(TRAIN_LAB_FILE, train_lab, TOTAL_SZ, "train labels");
-    const bool openTest = load_images(TEST_IMG_FILE, test_img, TEST_SZ, "test images") &&
-                          load_labels(TEST_LAB_FILE, test_lab, TEST_SZ, "test labels");
-
-    return openTrain && openTest;
-}
-
-
-void build_input(Byte img[][PIXEL_SZ], Byte lab[], Mat& input, Mat& sol, Index batch, Index batch_sz){
-    for(Index i = 0; i < batch_sz; ++i){
-        for(Index p = 0; p < PIXEL_SZ; ++p){
-            input(p, i) = (img[batch*batch_sz+i][p]/255.f);
-        }
-        sol(lab[batch*batch_sz+i], i) = 1.f;
+    sol.setZero();
+    for(Index i = 0; i < count; ++i){
+        input.col(i) = pixels.col(samples[i]);
+        sol(labels(0, samples[i]), i) = 1.f;
     }
-}
\ No newline at end of file
+}